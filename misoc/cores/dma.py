@@ -0,0 +1,128 @@
+from migen import *
+from migen.genlib.fsm import FSM, NextState
+from migen.genlib.fifo import SyncFIFO
+
+from misoc.interconnect.csr import *
+from misoc.interconnect.csr_eventmanager import *
+from misoc.interconnect import wishbone
+
+
+class DMA(Module, AutoCSR):
+    """Wishbone memory copy and fill engine
+
+    Copies ``length`` bytes from ``source`` to ``destination``, or fills them
+    with ``value`` when ``fill`` is set. Addresses and length are in bytes
+    and must be multiples of the bus width. Data is moved in chunks of
+    ``burst`` words, read into a FIFO and then written out, so that the
+    memory sees runs of sequential accesses instead of alternating reads and
+    writes. Each chunk is read and written with a linear incrementing burst,
+    which the arbiter may give to another master when it ends. The ``done``
+    event fires when the transfer started by ``start`` has completed.
+    """
+    def __init__(self, data_width=32, burst=8):
+        shift = log2_int(data_width//8)
+        self.bus = bus = wishbone.Interface(data_width, 32 - shift)
+
+        self._source = CSRStorage(32)
+        self._destination = CSRStorage(32)
+        self._length = CSRStorage(32)
+        self._fill = CSRStorage()
+        self._value = CSRStorage(data_width)
+        self._start = CSR()
+        self._busy = CSRStatus()
+
+        self.submodules.ev = EventManager()
+        self.ev.done = EventSourcePulse()
+        self.ev.finalize()
+
+        ###
+
+        source = Signal(32 - shift)
+        destination = Signal(32 - shift)
+        remaining = Signal(32 - shift)
+        count = Signal(max=burst)
+        last = Signal()
+
+        fifo = SyncFIFO(data_width, burst)
+        self.submodules += fifo
+
+        self.comb += [
+            bus.sel.eq(2**len(bus.sel) - 1),
+            bus.cti.eq(Mux(last, 0b111, 0b010)),
+            bus.bte.eq(0b00),
+            fifo.din.eq(bus.dat_r)
+        ]
+
+        self.submodules.fsm = fsm = FSM(reset_state="IDLE")
+        fsm.act("IDLE",
+            If(self._start.re & (self._length.storage[shift:] != 0),
+                NextValue(source, self._source.storage[shift:]),
+                NextValue(destination, self._destination.storage[shift:]),
+                NextValue(remaining, self._length.storage[shift:]),
+                NextValue(count, 0),
+                If(self._fill.storage,
+                    NextState("FILL")
+                ).Else(
+                    NextState("READ")
+                )
+            )
+        )
+        fsm.act("READ",
+            self._busy.status.eq(1),
+            bus.cyc.eq(1),
+            bus.stb.eq(1),
+            bus.adr.eq(source),
+            last.eq((remaining == 1) | (count == burst - 1)),
+            If(bus.ack,
+                fifo.we.eq(1),
+                NextValue(source, source + 1),
+                NextValue(remaining, remaining - 1),
+                NextValue(count, count + 1),
+                If(last,
+                    NextValue(count, 0),
+                    NextState("WRITE")
+                )
+            )
+        )
+        fsm.act("WRITE",
+            self._busy.status.eq(1),
+            bus.cyc.eq(1),
+            bus.stb.eq(1),
+            bus.we.eq(1),
+            bus.adr.eq(destination),
+            bus.dat_w.eq(fifo.dout),
+            last.eq(fifo.level == 1),
+            If(bus.ack,
+                fifo.re.eq(1),
+                NextValue(destination, destination + 1),
+                If(last,
+                    If(remaining == 0,
+                        self.ev.done.trigger.eq(1),
+                        NextState("IDLE")
+                    ).Else(
+                        NextState("READ")
+                    )
+                )
+            )
+        )
+        fsm.act("FILL",
+            self._busy.status.eq(1),
+            bus.cyc.eq(1),
+            bus.stb.eq(1),
+            bus.we.eq(1),
+            bus.adr.eq(destination),
+            bus.dat_w.eq(self._value.storage),
+            last.eq((remaining == 1) | (count == burst - 1)),
+            If(bus.ack,
+                NextValue(destination, destination + 1),
+                NextValue(remaining, remaining - 1),
+                NextValue(count, count + 1),
+                If(last,
+                    NextValue(count, 0)
+                ),
+                If(remaining == 1,
+                    self.ev.done.trigger.eq(1),
+                    NextState("IDLE")
+                )
+            )
+        )
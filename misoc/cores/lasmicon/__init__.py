@@ -0,0 +1 @@
+from misoc.cores.lasmicon.core import LASMIconSettings, LASMIcon
@@ -4,32 +4,61 @@ from operator import or_
 from migen import *
 from migen.genlib.fsm import FSM, NextState
 from migen.genlib.misc import WaitTimer
+from migen.genlib.fifo import SyncFIFO
 
 from misoc.interconnect import dfi as dfibus
 from misoc.interconnect import wishbone
 
 
 class _AddressSlicer:
-    def __init__(self, colbits, bankbits, rowbits, address_align):
+    """Splits a bus address into SDRAM column, bank and row.
+
+    ``mapping`` selects the order of the fields, from the most significant:
+
+    * ``"RBC"``: row, bank, column. Sequential accesses walk a whole row,
+      then move to the next bank.
+    * ``"BRC"``: bank, row, column. Each bank holds a contiguous quarter
+      (for 4 banks) of the memory, so streams in different regions use
+      different banks.
+    * ``"XOR"``: as RBC, with the low row bits XORed into the bank bits.
+      Addresses a multiple of a row-times-banks stride apart, e.g. arrays
+      with power-of-two sizes, then fall into different banks.
+    """
+    def __init__(self, colbits, bankbits, rowbits, address_align, mapping="RBC"):
+        if mapping not in ("RBC", "BRC", "XOR"):
+            raise ValueError("Unknown SDRAM address mapping: " + mapping)
         self.colbits = colbits
         self.bankbits = bankbits
         self.rowbits = rowbits
         self.address_align = address_align
+        self.mapping = mapping
         self.addressbits = colbits - address_align + bankbits + rowbits
 
+        split = colbits - address_align
+        if mapping == "BRC":
+            self._row_shift = split
+            self._bank_shift = split + rowbits
+        else:
+            self._row_shift = split + bankbits
+            self._bank_shift = split
+
     def row(self, address):
-        split = self.bankbits + self.colbits - self.address_align
         if isinstance(address, int):
-            return address >> split
+            return (address >> self._row_shift) & (2**self.rowbits - 1)
         else:
-            return address[split:self.addressbits]
+            return address[self._row_shift:self._row_shift+self.rowbits]
 
     def bank(self, address):
-        split = self.colbits - self.address_align
         if isinstance(address, int):
-            return (address & (2**(split + self.bankbits) - 1)) >> split
+            bank = (address >> self._bank_shift) & (2**self.bankbits - 1)
+            if self.mapping == "XOR":
+                bank ^= self.row(address) & (2**self.bankbits - 1)
+            return bank
         else:
-            return address[split:split+self.bankbits]
+            bank = address[self._bank_shift:self._bank_shift+self.bankbits]
+            if self.mapping == "XOR":
+                bank = bank ^ self.row(address)[:self.bankbits]
+            return bank
 
     def col(self, address):
         split = self.colbits - self.address_align
@@ -61,7 +90,8 @@ class _Bank(Module):
 
 
 class Minicon(Module):
-    def __init__(self, phy_settings, geom_settings, timing_settings, adr_width=30):
+    def __init__(self, phy_settings, geom_settings, timing_settings, adr_width=30,
+                 address_mapping="RBC"):
         if phy_settings.memtype in ["SDR"]:
             burst_length = phy_settings.nphases*1  # command multiplication*SDR
         elif phy_settings.memtype in ["DDR", "LPDDR", "DDR2", "DDR3"]:
@@ -82,6 +112,7 @@ class Minicon(Module):
         wrphase = phy_settings.wrphase
 
         precharge_all = Signal()
+        precharge = Signal()
         activate = Signal()
         refresh = Signal()
         write = Signal()
@@ -91,7 +122,8 @@ class Minicon(Module):
         slicer = _AddressSlicer(geom_settings.colbits,
                                 geom_settings.bankbits,
                                 geom_settings.rowbits,
-                                address_align)
+                                address_align,
+                                address_mapping)
 
         # Manage banks
         bank_idle = Signal()
@@ -123,24 +155,138 @@ class Minicon(Module):
         self.submodules +=  write2precharge_timer
         self.comb += write2precharge_timer.wait.eq(~write)
 
-        refresh_timer = WaitTimer(timing_settings.tREFI)
+        write2read_timer = WaitTimer(phy_settings.write_latency + 1 + timing_settings.tWTR)
+        self.submodules +=  write2read_timer
+        self.comb += write2read_timer.wait.eq(~write)
+
+        # Refresh: one refresh is owed every tREFI. Owed refreshes are
+        # postponed while the bus is busy, up to the 8 allowed by JEDEC, and
+        # refreshes are pulled in, up to 8 ahead, once the bus has been idle
+        # for a while.
+        refresh_timer = WaitTimer(timing_settings.tREFI - 1)
         self.submodules +=  refresh_timer
-        self.comb += refresh_timer.wait.eq(~refresh)
+        self.comb += refresh_timer.wait.eq(~refresh_timer.done)
+
+        refresh_idle_timer = WaitTimer(16)
+        self.submodules += refresh_idle_timer
+        self.comb += refresh_idle_timer.wait.eq(~(bus.cyc & bus.stb))
+
+        refresh_owed = Signal(min=-8, max=10)
+        refresh_req = Signal()
+        self.sync += \
+            If(refresh_timer.done & ~refresh,
+                # saturate rather than wrap if refreshes cannot keep up
+                If(refresh_owed != 9,
+                    refresh_owed.eq(refresh_owed + 1)
+                )
+            ).Elif(refresh & ~refresh_timer.done,
+                refresh_owed.eq(refresh_owed - 1)
+            )
+        self.comb += refresh_req.eq((refresh_owed >= 8) |
+                                    (refresh_idle_timer.done & (refresh_owed > -8)))
+
+        # Reads in flight, tracked from the command to the cycle their data
+        # is returned by the PHY. Reads of a stale stream are dropped; the
+        # bus waits for the data of a restarted stream, so a stale read is
+        # always back before the generation changes again.
+        generation = Signal()
+        inflight = Signal(phy_settings.read_latency)
+        inflight_generation = Signal(phy_settings.read_latency)
+        self.sync += [
+            inflight.eq(Cat(read, inflight)),
+            inflight_generation.eq(Cat(generation, inflight_generation))
+        ]
+        reading = Signal()
+        self.comb += reading.eq(inflight != 0)
+
+        # Read stream: reads of sequential addresses are issued ahead of the
+        # bus, their data is queued and acked as the bus asks for it.
+        # head is the address of the next beat to return, tail the address
+        # of the next read to issue.
+        depth = 2**bits_for(phy_settings.read_latency + 1)
+        fifo = ResetInserter()(SyncFIFO(burst_width, depth))
+        self.submodules += fifo
+        head = Signal(adr_width)
+        tail = Signal(adr_width)
+        pending = Signal(max=depth+1)
+        stream = Signal()
+        delivered = Signal()
+        sequential = Signal()
+        self.comb += [
+            pending.eq(tail - head),
+            fifo.din.eq(Cat(phase.rddata for phase in dfi.phases)),
+            fifo.we.eq(dfi.phases[rdphase].rddata_valid &
+                       inflight[-1] & (inflight_generation[-1] == generation))
+        ]
+
+        bus_read = Signal()
+        stream_hit = Signal()
+        restart = Signal()
+        invalidate = Signal()
+        issue_ok = Signal()
+        self.comb += [
+            bus_read.eq(bus.cyc & bus.stb & ~bus.we),
+            stream_hit.eq(stream & (bus.adr == head)),
+            # reads ahead stay in the open row of the bus access, and are
+            # limited to one until the bus has asked for the next address
+            issue_ok.eq(write2read_timer.done &
+                        (slicer.row(tail) == slicer.row(bus.adr)) &
+                        (slicer.bank(tail) == slicer.bank(bus.adr)) &
+                        (pending < Mux(sequential, depth, 1))),
+            fifo.reset.eq(restart | invalidate),
+            If(bus_read & stream_hit & fifo.readable,
+                bus.ack.eq(1),
+                fifo.re.eq(1)
+            )
+        ]
+        self.sync += [
+            If(restart,
+                generation.eq(~generation),
+                stream.eq(1),
+                delivered.eq(0),
+                sequential.eq(bus.cti == 0b010),
+                head.eq(bus.adr),
+                tail.eq(bus.adr)
+            ).Elif(invalidate,
+                stream.eq(0)
+            ).Else(
+                If(fifo.re,
+                    delivered.eq(1),
+                    head.eq(head + 1)
+                ),
+                If(read,
+                    tail.eq(tail + 1)
+                ),
+                # the bus asks for the beat after one it was given
+                If(bus_read & stream_hit & delivered,
+                    sequential.eq(1)
+                )
+            )
+        ]
 
         # Main FSM
         self.submodules.fsm = fsm = FSM()
         fsm.act("IDLE",
-            If(refresh_timer.done,
-                NextState("PRECHARGE-ALL")
+            If(refresh_req,
+                If(write2precharge_timer.done & ~reading,
+                    NextState("PRECHARGE-ALL")
+                )
             ).Elif(bus.stb & bus.cyc,
                 If(bank_hit,
                     If(bus.we,
-                        NextState("WRITE")
-                    ).Else(
-                        NextState("READ")
+                        # honour the read to write turnaround
+                        If(~reading,
+                            write.eq(1),
+                            invalidate.eq(1),
+                            bus.ack.eq(1)
+                        )
+                    ).Elif(~stream_hit,
+                        restart.eq(1)
+                    ).Elif(issue_ok,
+                        read.eq(1)
                     )
                 ).Elif(~bank_idle,
-                    If(write2precharge_timer.done,
+                    If(write2precharge_timer.done & ~reading,
                         NextState("PRECHARGE")
                     )
                 ).Else(
@@ -148,66 +294,66 @@ class Minicon(Module):
                 )
             )
         )
-        fsm.act("READ",
-            read.eq(1),
-            dfi.phases[rdphase].ras_n.eq(1),
-            dfi.phases[rdphase].cas_n.eq(0),
-            dfi.phases[rdphase].we_n.eq(1),
-            dfi.phases[rdphase].rddata_en.eq(1),
-            NextState("WAIT-READ-DONE"),
-        )
-        fsm.act("WAIT-READ-DONE",
-            If(dfi.phases[rdphase].rddata_valid,
-                bus.ack.eq(1),
-                NextState("IDLE")
-            )
-        )
-        fsm.act("WRITE",
-            write.eq(1),
-            dfi.phases[wrphase].ras_n.eq(1),
-            dfi.phases[wrphase].cas_n.eq(0),
-            dfi.phases[wrphase].we_n.eq(0),
-            dfi.phases[wrphase].wrdata_en.eq(1),
-            NextState("WRITE-LATENCY")
-        )
-        fsm.act("WRITE-ACK",
-            bus.ack.eq(1),
-            NextState("IDLE")
-        )
         fsm.act("PRECHARGE-ALL",
             precharge_all.eq(1),
-            dfi.phases[rdphase].ras_n.eq(0),
-            dfi.phases[rdphase].cas_n.eq(1),
-            dfi.phases[rdphase].we_n.eq(0),
             NextState("PRE-REFRESH")
         )
         fsm.act("PRECHARGE",
             # do no reset bank since we are going to re-open it
-            dfi.phases[0].ras_n.eq(0),
-            dfi.phases[0].cas_n.eq(1),
-            dfi.phases[0].we_n.eq(0),
+            precharge.eq(1),
             NextState("TRP")
         )
         fsm.act("ACTIVATE",
             activate.eq(1),
-            dfi.phases[0].ras_n.eq(0),
-            dfi.phases[0].cas_n.eq(1),
-            dfi.phases[0].we_n.eq(1),
             NextState("TRCD"),
         )
         fsm.act("REFRESH",
             refresh.eq(1),
-            dfi.phases[rdphase].ras_n.eq(0),
-            dfi.phases[rdphase].cas_n.eq(0),
-            dfi.phases[rdphase].we_n.eq(1),
             NextState("POST-REFRESH")
         )
-        fsm.delayed_enter("WRITE-LATENCY", "WRITE-ACK", phy_settings.write_latency-1)
         fsm.delayed_enter("TRP", "ACTIVATE", timing_settings.tRP-1)
         fsm.delayed_enter("TRCD", "IDLE", timing_settings.tRCD-1)
         fsm.delayed_enter("PRE-REFRESH", "REFRESH", timing_settings.tRP-1)
         fsm.delayed_enter("POST-REFRESH", "IDLE", timing_settings.tRFC-1)
 
+        # Commands. They are decoded from the FSM outputs rather than driven
+        # from its states, which keeps the FSM and the read and write
+        # commands it enables in separate combinatorial blocks.
+        self.comb += [
+            If(precharge_all,
+                dfi.phases[rdphase].ras_n.eq(0),
+                dfi.phases[rdphase].cas_n.eq(1),
+                dfi.phases[rdphase].we_n.eq(0)
+            ),
+            If(precharge,
+                dfi.phases[0].ras_n.eq(0),
+                dfi.phases[0].cas_n.eq(1),
+                dfi.phases[0].we_n.eq(0)
+            ),
+            If(activate,
+                dfi.phases[0].ras_n.eq(0),
+                dfi.phases[0].cas_n.eq(1),
+                dfi.phases[0].we_n.eq(1)
+            ),
+            If(refresh,
+                dfi.phases[rdphase].ras_n.eq(0),
+                dfi.phases[rdphase].cas_n.eq(0),
+                dfi.phases[rdphase].we_n.eq(1)
+            ),
+            If(read,
+                dfi.phases[rdphase].ras_n.eq(1),
+                dfi.phases[rdphase].cas_n.eq(0),
+                dfi.phases[rdphase].we_n.eq(1),
+                dfi.phases[rdphase].rddata_en.eq(1)
+            ),
+            If(write,
+                dfi.phases[wrphase].ras_n.eq(1),
+                dfi.phases[wrphase].cas_n.eq(0),
+                dfi.phases[wrphase].we_n.eq(0),
+                dfi.phases[wrphase].wrdata_en.eq(1)
+            )
+        ]
+
         # DFI commands
         for phase in dfi.phases:
             if hasattr(phase, "reset_n"):
@@ -222,14 +368,28 @@ class Minicon(Module):
                     phase.address.eq(2**10)
                 ).Elif(activate,
                      phase.address.eq(slicer.row(bus.adr))
-                ).Elif(write | read,
+                ).Elif(read,
+                    phase.address.eq(slicer.col(tail))
+                ).Elif(write,
                     phase.address.eq(slicer.col(bus.adr))
                 )
             ]
 
         # DFI datapath
+        # Writes are acked with their command, their data is presented to
+        # the PHY write_latency cycles later.
+        wrdata = bus.dat_w
+        wrdata_mask = ~bus.sel
+        for i in range(phy_settings.write_latency):
+            wrdata_r = Signal(len(wrdata))
+            wrdata_mask_r = Signal(len(wrdata_mask))
+            self.sync += [
+                wrdata_r.eq(wrdata),
+                wrdata_mask_r.eq(wrdata_mask)
+            ]
+            wrdata, wrdata_mask = wrdata_r, wrdata_mask_r
         self.comb += [
-            bus.dat_r.eq(Cat(phase.rddata for phase in dfi.phases)),
-            Cat(phase.wrdata for phase in dfi.phases).eq(bus.dat_w),
-            Cat(phase.wrdata_mask for phase in dfi.phases).eq(~bus.sel),
+            bus.dat_r.eq(fifo.dout),
+            Cat(phase.wrdata for phase in dfi.phases).eq(wrdata),
+            Cat(phase.wrdata_mask for phase in dfi.phases).eq(wrdata_mask),
         ]
@@ -3,8 +3,11 @@
 
 # SDRAM simulation PHY at DFI level
 # tested with SDR/DDR/DDR2/LPDDR/DDR3
-# TODO:
-# - add $display support to Migen and manage timing violations?
+# Timing violations are not detected by the PHY, run a DFITimingChecker
+# alongside it.
+
+from functools import reduce
+from operator import or_
 
 from migen import *
 from migen.fhdl.specials import *
@@ -140,16 +143,31 @@ class SDRAMPHYSim(Module):
                 ]
             self.comb += Case(precharges, cases)
 
-            # bank writes
+            # bank writes, the data follows the command by write_latency cycles
             writes = Signal(len(phases))
+            write = Signal()
+            write_col = Signal(max=ncols)
             cases = {}
             for np, phase in enumerate(phases):
                 self.comb += writes[np].eq(phase.write)
                 cases[2**np] = [
-                    bank.write.eq(phase.bank == nb),
-                    bank.write_col.eq(phase.address)
+                    write.eq(phase.bank == nb),
+                    write_col.eq(phase.address)
                 ]
             self.comb += Case(writes, cases)
+            for i in range(self.settings.write_latency):
+                new_write = Signal()
+                new_write_col = Signal(max=ncols)
+                self.sync += [
+                    new_write.eq(write),
+                    new_write_col.eq(write_col)
+                ]
+                write = new_write
+                write_col = new_write_col
+            self.comb += [
+                bank.write.eq(write),
+                bank.write_col.eq(write_col)
+            ]
             self.comb += [
                 bank.write_data.eq(Cat(*[phase.wrdata for phase in phases])),
                 bank.write_mask.eq(Cat(*[phase.wrdata_mask for phase in phases]))
@@ -170,8 +188,8 @@ class SDRAMPHYSim(Module):
         banks_read = Signal()
         banks_read_data = Signal(data_width)
         self.comb += [
-            banks_read.eq(optree("|", [bank.read for bank in banks])),
-            banks_read_data.eq(optree("|", [bank.read_data for bank in banks]))
+            banks_read.eq(reduce(or_, [bank.read for bank in banks])),
+            banks_read_data.eq(reduce(or_, [bank.read_data for bank in banks]))
         ]
         # simulate read latency
         for i in range(self.settings.read_latency):
@@ -188,3 +206,112 @@ class SDRAMPHYSim(Module):
             Cat(*[phase.rddata_valid for phase in phases]).eq(banks_read),
             Cat(*[phase.rddata for phase in phases]).eq(banks_read_data)
         ]
+
+
+class DFITimingChecker:
+    """Checks the commands a controller issues on a DFI interface.
+
+    ``run`` is a simulation generator. It records each command in
+    ``commands`` as ``(cycle, phase, command, bank, address)`` and raises
+    ``AssertionError`` on a command to a bank in the wrong state (ACTIVATE to
+    an open bank, READ or WRITE to a closed one, REFRESH with a bank open)
+    or one that comes too early after another:
+
+    * ACTIVATE: tRP after a PRECHARGE of the bank, tRFC after a REFRESH.
+    * READ and WRITE: tRCD after the ACTIVATE.
+    * READ: tWTR after the data of the last WRITE.
+    * WRITE: its data not before the data of the last READ.
+    * PRECHARGE: tWR after the data of the last WRITE to the bank.
+    * REFRESH: tRP after the last PRECHARGE, tRFC after the last REFRESH.
+
+    Times are counted in phases, the timings in system clock cycles.
+    """
+    def __init__(self, dfi, phy_settings, timing_settings):
+        self.dfi = dfi
+        self.phy_settings = phy_settings
+        self.timing_settings = timing_settings
+
+        self.commands = []
+
+        self._nbanks = 2**len(dfi.phases[0].bank)
+        self._open = [None]*self._nbanks
+        never = -2**32
+        self._precharged = [never]*self._nbanks
+        self._activated = [never]*self._nbanks
+        self._written = [never]*self._nbanks
+        self._write = never
+        self._read = never
+        self._refresh = never
+
+    def _check(self, ok, cycle, phase, command, rule):
+        if not ok:
+            raise AssertionError("cycle {} phase {}: {} {}"
+                                 .format(cycle, phase, command, rule))
+
+    def _after(self, t, last, delay):
+        return t - last >= delay*self.phy_settings.nphases
+
+    def _command(self, cycle, phase, command, bank, address):
+        self.commands.append((cycle, phase, command, bank, address))
+
+        ps = self.phy_settings
+        ts = self.timing_settings
+        check = lambda ok, rule: self._check(ok, cycle, phase, command, rule)
+        t = cycle*ps.nphases + phase
+
+        if command == "ACTIVATE":
+            check(self._open[bank] is None, "to an open bank")
+            check(self._after(t, self._precharged[bank], ts.tRP), "before tRP")
+            check(self._after(t, self._refresh, ts.tRFC), "before tRFC")
+            self._open[bank] = address
+            self._activated[bank] = t
+        elif command in ("READ", "WRITE"):
+            check(self._open[bank] is not None, "to a closed bank")
+            check(self._after(t, self._activated[bank], ts.tRCD), "before tRCD")
+            if command == "READ":
+                check(self._after(t, self._write, ps.write_latency + 1 + ts.tWTR),
+                      "before tWTR")
+                self._read = t
+            else:
+                check(self._after(t, self._read, ps.read_latency - ps.write_latency),
+                      "before the read data")
+                self._write = t
+                self._written[bank] = t
+        elif command == "PRECHARGE":
+            if len(self.dfi.phases[0].address) > 10 and address & 2**10:
+                banks = range(self._nbanks)
+            else:
+                banks = [bank]
+            for b in banks:
+                check(self._after(t, self._written[b], ps.write_latency + 1 + ts.tWR),
+                      "before tWR")
+                self._open[b] = None
+                self._precharged[b] = t
+        elif command == "REFRESH":
+            check(all(row is None for row in self._open), "with a bank open")
+            check(self._after(t, max(self._precharged), ts.tRP), "before tRP")
+            check(self._after(t, self._refresh, ts.tRFC), "before tRFC")
+            self._refresh = t
+
+    @passive
+    def run(self):
+        commands = {
+            # (ras_n, cas_n, we_n)
+            (0, 1, 1): "ACTIVATE",
+            (0, 1, 0): "PRECHARGE",
+            (0, 0, 1): "REFRESH",
+            (1, 0, 1): "READ",
+            (1, 0, 0): "WRITE"
+        }
+        cycle = 0
+        while True:
+            for n, phase in enumerate(self.dfi.phases):
+                if not (yield phase.cs_n):
+                    command = commands.get(((yield phase.ras_n),
+                                            (yield phase.cas_n),
+                                            (yield phase.we_n)))
+                    if command is not None:
+                        self._command(cycle, n, command,
+                                      (yield phase.bank), (yield phase.address))
+            cycle += 1
+            yield
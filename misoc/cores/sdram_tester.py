@@ -4,9 +4,7 @@ from operator import xor
 from migen import *
 
 from misoc.interconnect.csr import *
-from misoc.interconnect import dma_lasmi
-
-# TODO: implement or replace DMAControllers in MiSoC
+from misoc.interconnect import wishbone
 
 
 @ResetInserter()
@@ -34,75 +32,105 @@ class LFSR(Module):
 memtest_magic = 0x361f
 
 
-class Writer(Module):
-    def __init__(self, lasmim):
-        self._magic = CSRStatus(16)
-        self._reset = CSR()
-        self._shoot = CSR()
-        self.submodules._dma = DMAWriteController(dma_lasmi.Writer(lasmim),
-                                                  MODE_EXTERNAL)
+class _Sweep(Module):
+    """Sweeps a range of the native SDRAM bus with single transfers
+
+    ``base`` and ``length`` are byte offsets into main RAM and must be
+    multiples of the bus width. Writing ``start`` restarts the LFSR and
+    begins the sweep, ``cycles`` counts the clock cycles it has taken.
+    """
+    def __init__(self, bus, we):
+        self._base = CSRStorage(32)
+        self._length = CSRStorage(32)
+        self._start = CSR()
+        self._busy = CSRStatus()
+        self._cycles = CSRStatus(32)
+
+        self.submodules.lfsr = LFSR(len(bus.dat_w))
+        # high in the cycle the current word is transferred
+        self.transfer = Signal()
 
         ###
 
-        self.comb += self._magic.status.eq(memtest_magic)
+        shift = log2_int(len(bus.dat_w)//8)
+        adr = Signal(len(bus.adr))
+        remaining = Signal(32 - shift)
+        busy = self._busy.status
+        cycles = self._cycles.status
+        self.comb += [
+            busy.eq(remaining != 0),
+            self.transfer.eq(busy & bus.ack),
 
-        lfsr = LFSR(lasmim.dw)
-        self.submodules += lfsr
-        self.comb += lfsr.reset.eq(self._reset.re)
+            bus.cyc.eq(busy),
+            bus.stb.eq(busy),
+            bus.we.eq(we),
+            bus.adr.eq(adr),
+            bus.sel.eq(2**len(bus.sel) - 1),
 
-        en = Signal()
-        en_counter = Signal(lasmim.aw)
-        self.comb += en.eq(en_counter != 0)
+            self.lfsr.reset.eq(self._start.re),
+            self.lfsr.ce.eq(self.transfer)
+        ]
         self.sync += [
-            If(self._shoot.re,
-                en_counter.eq(self._dma.length)
-            ).Elif(lfsr.ce,
-                en_counter.eq(en_counter - 1)
+            If(self._start.re,
+                adr.eq(self._base.storage[shift:]),
+                remaining.eq(self._length.storage[shift:]),
+                cycles.eq(0)
+            ).Elif(busy,
+                cycles.eq(cycles + 1),
+                If(bus.ack,
+                    adr.eq(adr + 1),
+                    remaining.eq(remaining - 1)
+                )
             )
         ]
 
-        self.comb += [
-            self._dma.trigger.eq(self._shoot.re),
-            self._dma.data.stb.eq(en),
-            lfsr.ce.eq(en & self._dma.data.ack),
-            self._dma.data.d.eq(lfsr.o)
-        ]
 
-    def get_csrs(self):
-        return [self._magic, self._reset, self._shoot] + self._dma.get_csrs()
+class Writer(_Sweep, AutoCSR):
+    def __init__(self, bus):
+        _Sweep.__init__(self, bus, 1)
 
+        ###
 
-class Reader(Module):
-    def __init__(self, lasmim):
-        self._magic = CSRStatus(16)
-        self._reset = CSR()
-        self._error_count = CSRStatus(lasmim.aw)
-        self.submodules._dma = DMAReadController(dma_lasmi.Reader(lasmim),
-                                                 MODE_SINGLE_SHOT)
+        self.comb += bus.dat_w.eq(self.lfsr.o)
 
-        ###
 
-        self.comb += self._magic.status.eq(memtest_magic)
+class Reader(_Sweep, AutoCSR):
+    def __init__(self, bus):
+        _Sweep.__init__(self, bus, 0)
+        self._error_count = CSRStatus(32)
 
-        lfsr = LFSR(lasmim.dw)
-        self.submodules += lfsr
-        self.comb += lfsr.reset.eq(self._reset.re)
+        ###
 
-        self.comb += [
-            lfsr.ce.eq(self._dma.data.stb),
-            self._dma.data.ack.eq(1)
-        ]
         err_cnt = self._error_count.status
         self.sync += [
-            If(self._reset.re,
+            If(self._start.re,
                 err_cnt.eq(0)
-            ).Elif(self._dma.data.stb,
-                If(self._dma.data.d != lfsr.o, err_cnt.eq(err_cnt + 1))
+            ).Elif(self.transfer,
+                If(bus.dat_r != self.lfsr.o, err_cnt.eq(err_cnt + 1))
             )
         ]
 
-    def get_csrs(self):
-        return [self._magic, self._reset, self._error_count] + self._dma.get_csrs()
+
+class SDRAMTester(Module, AutoCSR):
+    """Memory tester on a native SDRAM interface
+
+    The writer fills a range with a pseudo-random sequence, the reader
+    regenerates it and counts the bus words that read back differently.
+    Both run one transfer after the other at the speed of the controller,
+    without going through the L2 cache.
+    """
+    def __init__(self, bus):
+        self._magic = CSRStatus(16)
+
+        write_bus = wishbone.Interface.like(bus)
+        read_bus = wishbone.Interface.like(bus)
+        self.submodules.writer = Writer(write_bus)
+        self.submodules.reader = Reader(read_bus)
+        self.submodules.arbiter = wishbone.Arbiter([write_bus, read_bus], bus)
+
+        ###
+
+        self.comb += self._magic.status.eq(memtest_magic)
 
 
 class _LFSRTB(Module):
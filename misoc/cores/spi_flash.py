@@ -30,13 +30,19 @@ def reverse_bytes(s):
         for i in reversed(range(n))])
 
 class SpiFlash(Module, AutoCSR):
-    def __init__(self, pads, dummy=15, div=2, with_bitbang=True, endianness="big", dw=32):
+    def __init__(self, pads, dummy=15, div=2, with_bitbang=True, endianness="big", dw=32,
+                 continuous_read=False):
         """
         Simple SPI flash, e.g. N25Q128 on the LX9 Microboard.
 
         Supports multi-bit pseudo-parallel reads (aka Dual or Quad I/O Fast
         Read). Only supports mode0 (cpol=0, cpha=0).
         Optionally supports software bitbanging (for write, erase, or other commands).
+
+        Optionally (continuous_read) keeps CS asserted after a read, so that
+        a read of the next word continues the transfer without a new command,
+        address and dummy cycles. Sequential reads (image copies, cache
+        refills) then run at the full SPI data rate.
         """
         adr_width = 32-log2_int(dw//8)
         self.bus = bus = wishbone.Interface(data_width=dw, adr_width=adr_width)
@@ -50,6 +56,7 @@ class SpiFlash(Module, AutoCSR):
 
         cs_n = Signal(reset=1)
         clk = Signal()
+        clk_en = Signal(reset=int(not continuous_read))
         dq_oe = Signal()
 
         read_cmd_params = {
@@ -116,7 +123,7 @@ class SpiFlash(Module, AutoCSR):
             dqi = Signal(spi_width)
             self.sync += [
                 If(i == div//2 - 1,
-                    clk.eq(1),
+                    clk.eq(clk_en),
                     dqi.eq(dq.i),
                 ),
                 If(i == div - 1,
@@ -131,15 +138,24 @@ class SpiFlash(Module, AutoCSR):
         # spi is byte-addressed, prefix by zeros
         z = Replicate(0, log2_int(dw//8))
 
+        start = bus.cyc & bus.stb & (i == div - 1)
+
+        if continuous_read:
+            cont = Signal()
+            next_adr = Signal(adr_width)
+            end_of_read = [clk_en.eq(0), cont.eq(1), next_adr.eq(bus.adr + 1)]
+        else:
+            end_of_read = [cs_n.eq(1)]
+
         seq = [
             (cmd_width//spi_width*div,
-                [dq_oe.eq(1), cs_n.eq(0), sr[-cmd_width:].eq(read_cmd)]),
+                [dq_oe.eq(1), cs_n.eq(0), clk_en.eq(1), sr[-cmd_width:].eq(read_cmd)]),
             (addr_width//spi_width*div,
                 [sr[-addr_width:].eq(Cat(z, bus.adr))]),
             ((dummy + dw//spi_width)*div,
                 [dq_oe.eq(0)]),
             (1,
-                [bus.ack.eq(1), cs_n.eq(1)]),
+                [bus.ack.eq(1)] + end_of_read),
             (div, # tSHSL!
                 [bus.ack.eq(0)]),
             (0,
@@ -152,4 +168,35 @@ class SpiFlash(Module, AutoCSR):
             tseq.append((t, a))
             t += dt
 
-        self.sync += timeline(bus.cyc & bus.stb & (i == div - 1), tseq)
+        if continuous_read:
+            # the flash streams the next word after a further dw/spi_width clocks
+            seq_cont = [
+                (dw//spi_width*div,
+                    [clk_en.eq(1)]),
+                (1,
+                    [bus.ack.eq(1), clk_en.eq(0), next_adr.eq(next_adr + 1)]),
+                (0,
+                    [bus.ack.eq(0)]),
+            ]
+            t, tseq_cont = 0, []
+            for dt, a in seq_cont:
+                tseq_cont.append((t, a))
+                t += dt
+
+            self.sync += timeline(start & ~cont & cs_n, tseq)
+            self.sync += timeline(start & cont & (bus.adr == next_adr), tseq_cont)
+            # a non-sequential access terminates the transfer, the next
+            # strobe starts a new command after tSHSL
+            self.sync += \
+                If(start & cont & (bus.adr != next_adr),
+                    cont.eq(0),
+                    cs_n.eq(1)
+                )
+            if with_bitbang:
+                self.sync += \
+                    If(self.bitbang_en.storage,
+                        cont.eq(0),
+                        cs_n.eq(1)
+                    )
+        else:
+            self.sync += timeline(start, tseq)
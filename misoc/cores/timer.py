@@ -5,12 +5,18 @@ from misoc.interconnect.csr_eventmanager import *
 
 
 class Timer(Module, AutoCSR):
-    def __init__(self, width=64):
+    def __init__(self, width=64, with_uptime=False):
         self._load = CSRStorage(width)
         self._reload = CSRStorage(width)
         self._en = CSRStorage()
         self._update_value = CSR()
         self._value = CSRStatus(width)
+        if with_uptime:
+            # free-running cycle count since configuration, unaffected
+            # by the timer registers above. Costs a 64-bit counter and
+            # 72 bits of CSR.
+            self._uptime_latch = CSR()
+            self._uptime_cycles = CSRStatus(64)
 
         self.submodules.ev = EventManager()
         self.ev.zero = EventSourceProcess()
@@ -33,3 +39,10 @@ class Timer(Module, AutoCSR):
             If(self._update_value.re, self._value.status.eq(value))
         ]
         self.comb += self.ev.zero.trigger.eq(value != 0)
+
+        if with_uptime:
+            uptime = Signal(64)
+            self.sync += [
+                uptime.eq(uptime + 1),
+                If(self._uptime_latch.re, self._uptime_cycles.status.eq(uptime))
+            ]
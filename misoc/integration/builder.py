@@ -91,6 +91,7 @@ class Builder:
         memory_regions = self.soc.get_memory_regions()
         memory_groups = self.soc.get_memory_groups()
         flash_boot_address = getattr(self.soc, "flash_boot_address", None)
+        sdram_mapping = getattr(self.soc, "sdram_mapping", None)
         csr_regions = self.soc.get_csr_regions()
         csr_groups = self.soc.get_csr_groups()
         constants = self.soc.get_constants()
@@ -127,7 +128,8 @@ class Builder:
             f.write(cpu_interface.get_linker_regions(memory_regions))
 
         with WriteGenerated(generated_dir, "mem.h") as f:
-            f.write(cpu_interface.get_mem_header(memory_regions, flash_boot_address))
+            f.write(cpu_interface.get_mem_header(memory_regions, flash_boot_address,
+                                                 sdram_mapping))
         with WriteGenerated(generated_dir, "csr.h") as f:
             f.write(cpu_interface.get_csr_header(csr_regions, constants, cpu_dw_bytes))
 
@@ -54,12 +54,20 @@ def get_linker_regions(regions):
     return r
 
 
-def get_mem_header(regions, flash_boot_address):
+def get_mem_header(regions, flash_boot_address, sdram_mapping=None):
     r = "#ifndef __GENERATED_MEM_H\n#define __GENERATED_MEM_H\n\n"
     for name, base, size in regions:
         r += "#define {name}_BASE 0x{base:08x}\n#define {name}_SIZE 0x{size:08x}\n\n".format(name=name.upper(), base=base, size=size)
     if flash_boot_address is not None:
         r += "#define FLASH_BOOT_ADDRESS 0x{:08x}\n\n".format(flash_boot_address)
+    if sdram_mapping is not None:
+        # field widths of a main_ram byte offset, column bits include the
+        # byte lanes
+        mapping, colbits, bankbits, rowbits = sdram_mapping
+        r += "#define SDRAM_MAPPING_{}\n".format(mapping)
+        r += "#define SDRAM_COLUMN_BITS {}\n".format(colbits)
+        r += "#define SDRAM_BANK_BITS {}\n".format(bankbits)
+        r += "#define SDRAM_ROW_BITS {}\n\n".format(rowbits)
     r += "#endif\n"
     return r
 
@@ -2,7 +2,7 @@ from operator import itemgetter
 
 from migen import *
 
-from misoc.cores import lm32, mor1kx, identifier, timer, uart, vexriscv
+from misoc.cores import lm32, mor1kx, identifier, timer, uart, vexriscv, dma
 from misoc.interconnect import wishbone, csr_bus, wishbone2csr
 from misoc.integration.wb_slaves import WishboneSlaveManager
 
@@ -27,7 +27,10 @@ class SoCCore(Module):
                 csr_data_width=8, csr_address_width=14,
                 with_uart=True, uart_baudrate=115200,
                 ident="",
-                with_timer=True):
+                with_timer=True, with_timer_uptime=True,
+                with_dma=False,
+                wb_interconnect="shared",
+                write_buffer_depth=0):
         self.platform = platform
         self.clk_freq = clk_freq
 
@@ -45,6 +48,11 @@ class SoCCore(Module):
 
         self.shadow_base = shadow_base
 
+        # "shared": one arbiter in front of all slaves, "crossbar": one
+        # arbiter per slave, or a dict mapping mem_map names to crossbar
+        # ports, slaves not in the dict getting a port of their own
+        self.wb_interconnect = wb_interconnect
+
         self._memory_regions = []  # list of (name, origin, length)
         self._csr_regions = []  # list of (name, origin, busword, csr_list/Memory)
         self._constants = []  # list of (name, value)
@@ -82,11 +90,19 @@ class SoCCore(Module):
         else:
             raise ValueError("Unsupported CPU type: {}; Bus width: {}".format(cpu_type, cpu_bus_width))
         self.add_wb_master(self.cpu.ibus)
-        self.add_wb_master(self.cpu.dbus)
+        if write_buffer_depth:
+            # posts the CPU stores, reads wait for them to complete
+            dbus = wishbone.Interface.like(self.cpu.dbus)
+            self.submodules.write_buffer = wishbone.WriteBuffer(self.cpu.dbus, dbus,
+                                                                write_buffer_depth)
+            self.add_wb_master(dbus)
+        else:
+            self.add_wb_master(self.cpu.dbus)
 
         self.cpu_dw = len(self.cpu.dbus.dat_w)
         assert(self.cpu_dw, cpu_bus_width)
         self.config["DATA_WIDTH_BYTES"] = self.cpu_dw//8
+        self.config["SHADOW_BASE"] = self.shadow_base
 
         self.csr_data_width = csr_data_width
         self.csr_address_width = csr_address_width
@@ -121,9 +137,16 @@ class SoCCore(Module):
         self.config["SOC_PLATFORM"] = platform.name
 
         if with_timer:
-            self.submodules.timer0 = timer.Timer()
+            # the uptime counter is used by the BIOS boot timeline
+            self.submodules.timer0 = timer.Timer(with_uptime=with_timer_uptime)
             self.interrupt_devices.append("timer0")
 
+        if with_dma:
+            self.submodules.dma = dma.DMA(self.cpu_dw)
+            self.add_wb_master(self.dma.bus)
+            self.csr_devices.append("dma")
+            self.interrupt_devices.append("dma")
+
     def add_wb_master(self, wbm):
         if self.finalized:
             raise FinalizeError
@@ -195,8 +218,21 @@ class SoCCore(Module):
         registered_mems = {regions[0] for regions in self._memory_regions}
 
         # Wishbone
-        self.submodules.wishbonecon = wishbone.InterconnectShared(self._wb_masters,
-            self._wb_slaves.get_interconnect_slaves(), register=True, dw=self.cpu_dw)
+        wb_slaves = self._wb_slaves.get_interconnect_slaves()
+        if self.wb_interconnect == "shared":
+            self.submodules.wishbonecon = wishbone.InterconnectShared(self._wb_masters,
+                wb_slaves, register=True, dw=self.cpu_dw)
+        elif self.wb_interconnect == "crossbar":
+            self.submodules.wishbonecon = wishbone.Crossbar(self._wb_masters,
+                wb_slaves, register=True)
+        elif isinstance(self.wb_interconnect, dict):
+            port_map = {self.mem_map[name]: port for name, port in self.wb_interconnect.items()}
+            ports = [port_map.get(origin, ("slave", origin))
+                     for origin, _, _ in self._wb_slaves.slaves]
+            self.submodules.wishbonecon = wishbone.Crossbar(self._wb_masters,
+                wb_slaves, register=True, ports=ports)
+        else:
+            raise ValueError("Unsupported Wishbone interconnect: {}".format(self.wb_interconnect))
 
         # CSR
         self.submodules.csrbankarray = csr_bus.CSRBankArray(self,
@@ -231,11 +267,14 @@ def soc_core_args(parser):
                         help="size/enable the integrated (BIOS) ROM")
     parser.add_argument("--integrated-main-ram-size", default=None, type=int,
                         help="size/enable the integrated main RAM")
+    parser.add_argument("--wb-interconnect", default=None,
+                        choices=["shared", "crossbar"],
+                        help="Wishbone interconnect topology: shared or crossbar")
 
 
 def soc_core_argdict(args):
     r = dict()
-    for a in "cpu_type", "cpu_bus_width", "integrated_rom_size", "integrated_main_ram_size":
+    for a in "cpu_type", "cpu_bus_width", "integrated_rom_size", "integrated_main_ram_size", "wb_interconnect":
         arg = getattr(args, a)
         if arg is not None:
             r[a] = arg
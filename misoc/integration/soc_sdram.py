@@ -3,7 +3,7 @@ from migen.genlib.record import *
 
 from misoc.interconnect import wishbone, wishbone2lasmi, lasmi_bus
 from misoc.interconnect.csr import AutoCSR
-from misoc.cores import dfii, minicon
+from misoc.cores import dfii, minicon, lasmicon, sdram_tester
 from misoc.integration.soc_core import *
 
 
@@ -11,14 +11,22 @@ __all__ = ["SoCSDRAM", "soc_sdram_args", "soc_sdram_argdict"]
 
 
 class SoCSDRAM(SoCCore):
-    def __init__(self, platform, clk_freq, l2_size=8192, **kwargs):
+    def __init__(self, platform, clk_freq, l2_size=8192, l2_pipelined=False,
+                 l2_ways=1, with_sdram_tester=False, sdram_address_mapping="RBC",
+                 **kwargs):
         SoCCore.__init__(self, platform, clk_freq,
                          integrated_main_ram_size=0, **kwargs)
         self.csr_devices += ["dfii", "l2_cache"]
+        if with_sdram_tester:
+            self.csr_devices.append("sdram_tester")
+        self.with_sdram_tester = with_sdram_tester
 
         if l2_size:
             self.config["L2_SIZE"] = l2_size
         self.l2_size = l2_size
+        self.l2_pipelined = l2_pipelined
+        self.l2_ways = l2_ways
+        self.sdram_address_mapping = sdram_address_mapping
 
         self._sdram_phy = []
         self._cpulevel_sdram_ifs = []
@@ -44,10 +52,15 @@ class SoCSDRAM(SoCCore):
             bus = wishbone.Interface(len(self.sdram_controller.bus.dat_w), adr_width=32-log2_int(self.cpu_dw//8))
             self._native_sdram_ifs.append(bus)
             return bus
+        elif isinstance(self.sdram_controller, lasmicon.LASMIcon):
+            bus = wishbone.Interface(self.sdram_controller.lasmic.dw, adr_width=32-log2_int(self.cpu_dw//8))
+            self.submodules += wishbone2lasmi.WB2LASMI(bus, self.lasmi_crossbar.get_master())
+            return bus
         else:
             raise TypeError
 
-    def register_sdram(self, phy, sdram_controller_type, geom_settings, timing_settings):
+    def register_sdram(self, phy, sdram_controller_type, geom_settings, timing_settings,
+                       controller_settings=None):
         # register PHY
         assert not self._sdram_phy
         self._sdram_phy.append(phy)  # encapsulate in list to prevent CSR scanning
@@ -60,6 +73,14 @@ class SoCSDRAM(SoCCore):
                             geom_settings.colbits)*sdram_width//8
         # TODO: modify mem_map to allow larger memories.
         main_ram_size = min(main_ram_size, 256*1024*1024)
+        # rows beyond main_ram_size are not mapped, drop them from the
+        # geometry so that BRC puts the bank bits at the top of main_ram
+        rowbits = log2_int(main_ram_size*8//sdram_width) - geom_settings.bankbits - geom_settings.colbits
+        geom_settings = geom_settings._replace(rowbits=rowbits)
+        # software view of the mapping, in byte address bits
+        self.sdram_mapping = (self.sdram_address_mapping,
+                              geom_settings.colbits + log2_int(sdram_width//8),
+                              geom_settings.bankbits, rowbits)
         wb_sdram = wishbone.Interface(data_width=self.cpu_dw, adr_width=32-log2_int(self.cpu_dw//8))
         self.add_cpulevel_sdram_if(wb_sdram)
         self.register_mem("main_ram", self.mem_map["main_ram"],
@@ -74,27 +95,47 @@ class SoCSDRAM(SoCCore):
         # create controller
         if sdram_controller_type == "minicon":
             self.submodules.sdram_controller = minicon.Minicon(
-                phy.settings, geom_settings, timing_settings, adr_width=32-log2_int(self.cpu_dw//8))
+                phy.settings, geom_settings, timing_settings, adr_width=32-log2_int(self.cpu_dw//8),
+                address_mapping=self.sdram_address_mapping)
             self._native_sdram_ifs = []
-
-            bridge_if = self.get_native_sdram_if()
-            if self.l2_size:
-                l2_cache = wishbone.Cache(self.l2_size//4,
-                    self._cpulevel_sdram_if_arbitrated, bridge_if)
-                # XXX Vivado ->2015.1 workaround, Vivado is not able to map correctly our L2 cache.
-                # Issue is reported to Xilinx and should be fixed in next releases (> 2017.2).
-                # Remove this workaround when fixed by Xilinx.
-                from migen.build.xilinx.vivado import XilinxVivadoToolchain
-                if isinstance(self.platform.toolchain, XilinxVivadoToolchain):
-                    from migen.fhdl.simplify import FullMemoryWE
-                    self.submodules.l2_cache = FullMemoryWE()(l2_cache)
-                else:
-                    self.submodules.l2_cache = l2_cache
+        elif sdram_controller_type == "lasmicon":
+            # each native interface is a separate crossbar master, so that
+            # requests to different banks are queued and served in parallel
+            self.submodules.sdram_controller = lasmicon.LASMIcon(
+                phy.settings, geom_settings, timing_settings, controller_settings)
+            if self.sdram_address_mapping == "RBC":
+                cba_shift = self.sdram_controller.nrowbits
+            elif self.sdram_address_mapping == "BRC":
+                cba_shift = self.sdram_controller.nrowbits + geom_settings.rowbits
             else:
-                self.submodules.converter = wishbone.Converter(
-                    self._cpulevel_sdram_if_arbitrated, bridge_if)
+                raise ValueError("LASMIcon does not support the {} address mapping"
+                                 .format(self.sdram_address_mapping))
+            self.submodules.lasmi_crossbar = lasmi_bus.LASMIxbar(
+                [self.sdram_controller.lasmic], cba_shift)
         else:
             raise ValueError("Incorrect SDRAM controller type specified")
+
+        bridge_if = self.get_native_sdram_if()
+        if self.l2_size:
+            l2_cache = wishbone.Cache(self.l2_size//4,
+                self._cpulevel_sdram_if_arbitrated, bridge_if,
+                pipelined=self.l2_pipelined, ways=self.l2_ways)
+            # XXX Vivado ->2015.1 workaround, Vivado is not able to map correctly our L2 cache.
+            # Issue is reported to Xilinx and should be fixed in next releases (> 2017.2).
+            # Remove this workaround when fixed by Xilinx.
+            from migen.build.xilinx.vivado import XilinxVivadoToolchain
+            if isinstance(self.platform.toolchain, XilinxVivadoToolchain):
+                from migen.fhdl.simplify import FullMemoryWE
+                self.submodules.l2_cache = FullMemoryWE()(l2_cache)
+            else:
+                self.submodules.l2_cache = l2_cache
+        else:
+            self.submodules.converter = wishbone.Converter(
+                self._cpulevel_sdram_if_arbitrated, bridge_if)
+
+        if self.with_sdram_tester:
+            self.submodules.sdram_tester = sdram_tester.SDRAMTester(
+                self.get_native_sdram_if())
         self.comb += self.sdram_controller.dfi.connect(self.dfii.slave)
 
     def do_finalize(self):
@@ -113,19 +154,37 @@ class SoCSDRAM(SoCCore):
         SoCCore.do_finalize(self)
 
 
-def soc_sdram_args(parser):
+def soc_sdram_args(parser, with_sdram_controller=False):
     parser.add_argument("--cpu-type", default=None,
                         help="select CPU: lm32, or1k, vexriscv, vexriscv-g")
     parser.add_argument("--cpu-bus-width", default=None, type=int,
                         help="width of CPU IBus/DBus in bits: 32 or 64")
     parser.add_argument("--integrated-rom-size", default=None, type=int,
                         help="size/enable the integrated (BIOS) ROM")
+    parser.add_argument("--wb-interconnect", default=None,
+                        choices=["shared", "crossbar"],
+                        help="Wishbone interconnect topology: shared or crossbar")
+    parser.add_argument("--with-sdram-tester", default=None, action="store_true",
+                        help="add the DMA memory tester used by 'memtest full'")
+    if with_sdram_controller:
+        # only for targets whose SoC takes sdram_controller_type
+        parser.add_argument("--sdram-controller", dest="sdram_controller_type",
+                            default=None, choices=["minicon", "lasmicon"],
+                            help="SDRAM controller: minicon (single-bank, low "
+                                 "latency) or lasmicon (multi-bank, for several "
+                                 "masters)")
+    parser.add_argument("--sdram-address-mapping", default=None,
+                        choices=["RBC", "BRC", "XOR"],
+                        help="SDRAM address mapping: row-bank-column, "
+                             "bank-row-column, or row-bank-column with the "
+                             "row XORed into the bank (XOR is Minicon only)")
 
 
 def soc_sdram_argdict(args):
     r = dict()
-    for a in "cpu_type", "cpu_bus_width", "integrated_rom_size":
-        arg = getattr(args, a)
+    for a in ("cpu_type", "cpu_bus_width", "integrated_rom_size", "wb_interconnect",
+              "with_sdram_tester", "sdram_controller_type", "sdram_address_mapping"):
+        arg = getattr(args, a, None)
         if arg is not None:
             r[a] = arg
     return r
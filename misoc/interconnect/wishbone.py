@@ -5,12 +5,10 @@ from migen import *
 from migen.genlib import roundrobin
 from migen.genlib.record import *
 from migen.genlib.misc import split, displacer, chooser
-from migen.genlib.fsm import FSM, NextState
+from migen.genlib.fsm import FSM, NextState, NextValue
 
 from misoc.interconnect import csr
 
-# TODO: rewrite without FlipFlop
-
 
 _layout = [
     ("adr",    "adr_width", DIR_M_TO_S),
@@ -63,6 +61,16 @@ class Interface(Record):
         return (yield self.dat_r)
 
 
+def _burst_next(adr, bte):
+    """Returns the address of the beat that follows ``adr`` in an
+    incrementing burst of type ``bte``: linear, or wrapping at 4, 8 or 16
+    beats"""
+    wrap = [Cat((adr + 1)[:n], adr[n:]) for n in (2, 3, 4)]
+    return Mux(bte == 0b00, adr + 1,
+           Mux(bte == 0b01, wrap[0],
+           Mux(bte == 0b10, wrap[1], wrap[2])))
+
+
 class InterconnectPointToPoint(Module):
     def __init__(self, master, slave):
         self.comb += master.connect(slave)
@@ -89,8 +97,10 @@ class Arbiter(Module):
                     else:
                         self.comb += dest.eq(source)
 
-        # connect bus requests to round-robin selector
-        reqs = [m.cyc & ~m.ack for m in masters]
+        # connect bus requests to round-robin selector, a master keeps the
+        # bus until the last beat of its burst is acked
+        reqs = [m.cyc & ~(m.ack & ((m.cti == 0b000) | (m.cti == 0b111)))
+                for m in masters]
         self.comb += self.rr.request.eq(Cat(*reqs))
 
 
@@ -143,9 +153,27 @@ class InterconnectShared(Module):
 
 
 class Crossbar(Module):
-    def __init__(self, masters, slaves, register=False):
+    # slaves is a list of pairs as for Decoder, each having its own arbiter
+    # so that masters accessing different slaves transfer in parallel.
+    # ports optionally gives for each slave the crossbar port it is
+    # connected to: slaves sharing a port are decoded behind a common
+    # arbiter (partial crossbar).
+    def __init__(self, masters, slaves, register=False, ports=None):
+        if ports is not None:
+            port_slaves = []
+            for port in sorted(set(ports), key=ports.index):
+                members = [slave for slave, p in zip(slaves, ports) if p == port]
+                if len(members) == 1:
+                    port_slaves.append(members[0])
+                else:
+                    bus = Interface.like(masters[0])
+                    self.submodules += Decoder(bus, members, register)
+                    funs = [fun for fun, _ in members]
+                    port_slaves.append((lambda adr, funs=funs: reduce(or_, [fun(adr) for fun in funs]), bus))
+            slaves = port_slaves
+
         matches, busses = zip(*slaves)
-        access = [[Interface() for j in slaves] for i in masters]
+        access = [[Interface.like(master) for j in slaves] for master in masters]
         # decode each master into its access row
         for row, master in zip(access, masters):
             row = list(zip(matches, row))
@@ -169,6 +197,10 @@ class DownConverter(Module):
         Read from master are splitted in N reads to the the slave. Read datas from
         the slave are cached before being presented concatenated on the last access.
 
+    Bursts:
+        The N slave accesses are issued as an incrementing burst. A linear
+        incrementing burst from the master continues as a single slave burst.
+
     TODO:
         Manage err signal? (Not implemented since we generally don't use it on Migen/MiSoC modules)
     """
@@ -194,6 +226,9 @@ class DownConverter(Module):
         counter_done = Signal()
         self.comb += counter_done.eq(counter == ratio-1)
 
+        burst = Signal()
+        self.comb += burst.eq((master.cti == 0b010) & (master.bte == 0b00))
+
         # Main FSM
         self.submodules.fsm = fsm = FSM(reset_state="IDLE")
         fsm.act("IDLE",
@@ -216,7 +251,11 @@ class DownConverter(Module):
                     counter_ce.eq(1),
                     If(counter_done,
                         master.ack.eq(1),
-                        NextState("IDLE")
+                        If(burst,
+                            counter_reset.eq(1)
+                        ).Else(
+                            NextState("IDLE")
+                        )
                     )
                 )
             ).Elif(~master.cyc,
@@ -232,7 +271,11 @@ class DownConverter(Module):
                     counter_ce.eq(1),
                     If(counter_done,
                         master.ack.eq(1),
-                        NextState("IDLE")
+                        If(burst,
+                            counter_reset.eq(1)
+                        ).Else(
+                            NextState("IDLE")
+                        )
                     )
                 )
             ).Elif(~master.cyc,
@@ -242,7 +285,7 @@ class DownConverter(Module):
 
         # Address
         self.comb += [
-            If(counter_done,
+            If(counter_done & ~burst,
                 slave.cti.eq(7) # indicate end of burst
             ).Else(
                 slave.cti.eq(2)
@@ -281,7 +324,8 @@ class UpConverter(Module):
 
     Reads:
         Cache is refilled only at the beginning of each burst, the subsequent
-        reads of a burst use the cached data.
+        reads of a burst use the cached data. Reads of a linear incrementing
+        burst are acked in consecutive cycles until the end of the cached data.
 
     TODO:
         Manage err signal? (Not implemented since we generally don't use it on Migen/MiSoC modules)
@@ -299,9 +343,9 @@ class UpConverter(Module):
         refill = Signal()
         read = Signal()
 
-        address = FlipFlop(30)
-        self.submodules += address
-        self.comb += address.d.eq(master.adr)
+        address = Signal(30)
+        address_ce = Signal()
+        self.sync += If(address_ce, address.eq(master.adr))
 
         counter = Signal(max=ratio)
         counter_ce = Signal()
@@ -315,7 +359,11 @@ class UpConverter(Module):
         counter_offset = Signal(max=ratio)
         counter_done = Signal()
         self.comb += [
-            counter_offset.eq(address.q),
+            If(read,
+                counter_offset.eq(master.adr)
+            ).Else(
+                counter_offset.eq(address)
+            ),
             counter_done.eq((counter + counter_offset) == ratio-1)
         ]
 
@@ -327,23 +375,25 @@ class UpConverter(Module):
                                      (master.stb & master.cyc & master.ack & ((master.cti == 7) | counter_done)))
 
 
-        need_refill = FlipFlop(reset=1)
-        self.submodules += need_refill
-        self.comb += [
-            need_refill.reset.eq(end_of_burst),
-            need_refill.d.eq(0)
-        ]
+        need_refill = Signal(reset=1)
+        need_refill_ce = Signal()
+        self.sync += \
+            If(end_of_burst,
+                need_refill.eq(1)
+            ).Elif(need_refill_ce,
+                need_refill.eq(0)
+            )
 
         # Main FSM
         self.submodules.fsm = fsm = FSM()
         fsm.act("IDLE",
             counter_reset.eq(1),
             If(master.stb & master.cyc,
-                address.ce.eq(1),
+                address_ce.eq(1),
                 If(master.we,
                     NextState("WRITE")
                 ).Else(
-                    If(need_refill.q,
+                    If(need_refill,
                         NextState("REFILL")
                     ).Else(
                         NextState("READ")
@@ -379,56 +429,64 @@ class UpConverter(Module):
             slave.stb.eq(1),
             slave.cyc.eq(1),
             If(slave.ack,
-                need_refill.ce.eq(1),
+                need_refill_ce.eq(1),
                 NextState("READ")
             )
         )
         fsm.act("READ",
             read.eq(1),
             If(master.stb & master.cyc,
-                master.ack.eq(1)
-            ),
-            NextState("IDLE")
+                master.ack.eq(1),
+                If((master.cti == 0b010) & (master.bte == 0b00) & ~counter_done,
+                    NextState("READ")
+                ).Else(
+                    NextState("IDLE")
+                )
+            ).Else(
+                NextState("IDLE")
+            )
         )
 
         # Address
         self.comb += [
             slave.cti.eq(7), # we are not able to generate bursts since up-converting
-            slave.adr.eq(address.q[ratiobits:])
+            slave.adr.eq(address[ratiobits:])
         ]
 
         # Datapath
-        cached_datas = [FlipFlop(dw_from) for i in range(ratio)]
-        cached_sels = [FlipFlop(dw_from//8) for i in range(ratio)]
-        self.submodules += cached_datas, cached_sels
+        cached_datas = [Signal(dw_from) for i in range(ratio)]
+        cached_sels = [Signal(dw_from//8) for i in range(ratio)]
 
         cases = {}
         for i in range(ratio):
             write_sel = Signal()
             cases[i] = write_sel.eq(1)
-            self.comb += [
-                cached_sels[i].reset.eq(counter_reset),
-                If(write,
-                    cached_datas[i].d.eq(master.dat_w),
-                ).Else(
-                    cached_datas[i].d.eq(slave.dat_r[dw_from*i:dw_from*(i+1)])
+            cached_ce = Signal()
+            self.comb += cached_ce.eq((write & write_sel) | refill)
+            self.sync += [
+                If(cached_ce,
+                    If(write,
+                        cached_datas[i].eq(master.dat_w),
+                    ).Else(
+                        cached_datas[i].eq(slave.dat_r[dw_from*i:dw_from*(i+1)])
+                    )
                 ),
-                cached_sels[i].d.eq(master.sel),
-                If((write & write_sel) | refill,
-                    cached_datas[i].ce.eq(1),
-                    cached_sels[i].ce.eq(1)
+                If(counter_reset,
+                    cached_sels[i].eq(0)
+                ).Elif(cached_ce,
+                    cached_sels[i].eq(master.sel)
                 )
             ]
         self.comb += Case(counter + counter_offset, cases)
 
         cases = {}
         for i in range(ratio):
-            cases[i] = master.dat_r.eq(cached_datas[i].q)
-        self.comb += Case(address.q[:ratiobits], cases)
+            cases[i] = master.dat_r.eq(cached_datas[i])
+        self.comb += Case(master.adr[:ratiobits], cases)
 
         self.comb += [
-            cached_data.eq(Cat([cached_data.q for cached_data in cached_datas])),
-            cached_sel.eq(Cat([cached_sel.q for cached_sel in cached_sels]))
+            cached_data.eq(Cat(*cached_datas)),
+            cached_sel.eq(Cat(*cached_sels))
         ]
 
 
@@ -457,16 +515,179 @@ class Converter(Module):
             self.comb += master.connect(slave)
 
 
-class Cache(Module):
+class WriteBuffer(Module):
+    """WriteBuffer
+
+    This module posts Wishbone writes from a master to a slave.
+
+    Writes:
+        Writes are acked as soon as they are queued, up to ``depth`` of
+        them, and are performed on the slave in order. A write to the same
+        address as the last queued one, with no byte lane in common with it,
+        is merged into it unless it is already being performed.
+
+    Reads:
+        Reads wait until all queued writes are done, then go to the slave.
+    """
+    def __init__(self, master, slave, depth=4):
+        self.master = master
+        self.slave = slave
+
+        # # #
+
+        log2_int(depth)
+        if depth < 2:
+            raise ValueError("Write buffer depth must be at least 2")
+
+        adrs = Array(Signal(len(master.adr)) for i in range(depth))
+        dats = Array(Signal(len(master.dat_w)) for i in range(depth))
+        sels = Array(Signal(len(master.sel)) for i in range(depth))
+        produce = Signal(max=depth)
+        consume = Signal(max=depth)
+        level = Signal(max=depth+1)
+        last = Signal(max=depth)
+        last_dat = Signal(len(master.dat_w))
+        self.comb += [
+            last.eq(produce - 1),
+            last_dat.eq(dats[last])
+        ]
+
+        write = Signal()
+        read = Signal()
+        merge = Signal()
+        push = Signal()
+        pop = Signal()
+        self.comb += [
+            write.eq(master.cyc & master.stb & master.we),
+            read.eq(master.cyc & master.stb & ~master.we),
+            # the last queued write is not on the slave bus when another
+            # one is queued before it
+            merge.eq(write & (level > 1) &
+                     (adrs[last] == master.adr) &
+                     ((sels[last] & master.sel) == 0)),
+            push.eq(write & ~merge & (level != depth)),
+            master.ack.eq(merge | push)
+        ]
+        self.sync += [
+            If(push,
+                adrs[produce].eq(master.adr),
+                dats[produce].eq(master.dat_w),
+                sels[produce].eq(master.sel),
+                produce.eq(produce + 1)
+            ),
+            If(merge,
+                dats[last].eq(
+                    Cat(*[Mux(master.sel[i], master.dat_w[8*i:8*(i+1)],
+                              last_dat[8*i:8*(i+1)])
+                          for i in range(len(master.sel))])),
+                sels[last].eq(sels[last] | master.sel)
+            ),
+            If(pop,
+                consume.eq(consume + 1)
+            ),
+            If(push & ~pop,
+                level.eq(level + 1)
+            ).Elif(pop & ~push,
+                level.eq(level - 1)
+            )
+        ]
+
+        self.comb += \
+            If(level != 0,
+                slave.cyc.eq(1),
+                slave.stb.eq(1),
+                slave.we.eq(1),
+                slave.adr.eq(adrs[consume]),
+                slave.dat_w.eq(dats[consume]),
+                slave.sel.eq(sels[consume]),
+                pop.eq(slave.ack)
+            ).Elif(read,
+                slave.cyc.eq(1),
+                slave.stb.eq(1),
+                slave.adr.eq(master.adr),
+                slave.sel.eq(master.sel),
+                slave.cti.eq(master.cti),
+                slave.bte.eq(master.bte),
+                master.ack.eq(slave.ack)
+            )
+        self.comb += master.dat_r.eq(slave.dat_r)
+
+
+def _plru_victim(bits, ways):
+    """Returns a list of (way, condition) so that condition is true when the
+    tree pseudo-LRU state ``bits`` designates ``way`` for replacement"""
+    r = []
+    waybits = log2_int(ways)
+    for way in range(ways):
+        node = 0
+        condition = 1
+        for level in range(waybits):
+            direction = (way >> (waybits - 1 - level)) & 1
+            condition = condition & (bits[node] == direction)
+            node = 2*node + 1 + direction
+        r.append((way, condition))
+    return r
+
+
+def _plru_update(bits, new_bits, way, ways):
+    """Returns the statements that set ``new_bits`` to the tree pseudo-LRU
+    state ``bits`` after an access to ``way``: the nodes on its path point
+    away from it"""
+    waybits = log2_int(ways)
+    cases = dict()
+    for w in range(ways):
+        node = 0
+        statements = []
+        for level in range(waybits):
+            direction = (w >> (waybits - 1 - level)) & 1
+            statements.append(new_bits[node].eq(1 - direction))
+            node = 2*node + 1 + direction
+        cases[w] = statements
+    return [new_bits.eq(bits), Case(way, cases)]
+
+
+class Cache(Module, csr.AutoCSR):
     """Cache
 
     This module is a write-back wishbone cache that can be used as a L2 cache.
     Cachesize (in 32-bit words) is the size of the data store and must be a power of 2
+
+    With ``ways`` above 1 (a power of 2), the cache is set-associative: each
+    line can be held in any of the ways of its set, the victim of a refill
+    being an invalid way if there is one, the tree pseudo-LRU way otherwise.
+
+    Maintenance operations are started through CSRs and walk the tag memory
+    in hardware, holding off the master until ``busy`` goes low:
+
+    * ``flush`` writes back all dirty lines and invalidates the cache,
+    * ``invalidate`` drops all lines without writing them back,
+    * ``writeback`` writes back the dirty lines that hold bytes of the range
+      of ``writeback_length`` bytes starting at master byte address
+      ``writeback_base``, and keeps them valid.
+
+    With ``pipelined`` set, a read hit also looks up the next sequential
+    address, so that if the master asks for it right after the ``ack`` it
+    hits in a single cycle. Sequential read hits then stream at one per
+    cycle; other accesses take the usual extra lookup cycle.
+
+    Lines wider than a slave word are transferred as incrementing bursts.
+    When a line is a single slave word, a read miss is acked as soon as the
+    word arrives from the slave. A dirty victim is moved to a one-line
+    write-back buffer so that the refill does not wait for the eviction;
+    the buffer is written to the slave when the cache is idle, or before
+    it is needed again.
     """
-    def __init__(self, cachesize, master, slave):
+    def __init__(self, cachesize, master, slave, pipelined=False, ways=1):
         self.master = master
         self.slave = slave
 
+        self._flush = csr.CSR()
+        self._invalidate = csr.CSR()
+        self._writeback = csr.CSR()
+        self._writeback_base = csr.CSRStorage(32)
+        self._writeback_length = csr.CSRStorage(32)
+        self._busy = csr.CSRStatus()
+
         # # #
 
         dw_from = len(master.dat_r)
@@ -478,63 +699,190 @@ class Cache(Module):
 
         # Split address:
         # TAG | LINE NUMBER | LINE OFFSET
+        # With several ways, the line number selects a set of lines.
         offsetbits = log2_int(max(dw_to//dw_from, 1))
+        waybits = log2_int(ways)
         addressbits = len(slave.adr) + offsetbits
-        linebits = log2_int(cachesize) - offsetbits
+        linebits = log2_int(cachesize) - offsetbits - waybits
         tagbits = addressbits - linebits
         wordbits = log2_int(max(dw_from//dw_to, 1))
         adr_offset, adr_line, adr_tag = split(master.adr, offsetbits, linebits, tagbits)
         word = Signal(wordbits) if wordbits else None
 
-        # Data memory
-        data_mem = Memory(dw_to*2**wordbits, 2**linebits)
-        data_port = data_mem.get_port(write_capable=True, we_granularity=8)
-        self.specials += data_mem, data_port
+        # Line accessed: the one of the master address, the one after it
+        # when looking ahead, or the one visited by a maintenance walk
+        walk = Signal()
+        walk_line = Signal(linebits)
+        lookahead = Signal()
+        adr_next = Signal(len(master.adr))
+        self.comb += adr_next.eq(master.adr + 1)
+        next_offset, next_line, _ = split(adr_next, offsetbits, linebits, tagbits)
+        line = Signal(linebits)
+        self.comb += \
+            If(walk,
+                line.eq(walk_line)
+            ).Elif(lookahead,
+                line.eq(next_line)
+            ).Else(
+                line.eq(adr_line)
+            )
+
+        # Master address whose line is read from the memories in this cycle
+        presented = Signal(len(master.adr))
+        self.sync += If(lookahead, presented.eq(adr_next)).Else(presented.eq(master.adr))
+        fresh = Signal()
+        if pipelined:
+            self.comb += fresh.eq(presented == master.adr)
+        else:
+            self.comb += fresh.eq(1)
+
+        # Way accessed, driven by the control FSM
+        way = Signal(max=max(ways, 2))
+
+        # Data memories, one per way
+        data_dat_w = Signal(dw_to*2**wordbits)
+        data_we = Signal(dw_to*2**wordbits//8)
+        data_dat_r = Signal(dw_to*2**wordbits)
+        data_ports = []
+        for i in range(ways):
+            data_mem = Memory(dw_to*2**wordbits, 2**linebits)
+            data_port = data_mem.get_port(write_capable=True, we_granularity=8)
+            self.specials += data_mem, data_port
+            self.comb += [
+                data_port.adr.eq(line),
+                data_port.dat_w.eq(data_dat_w),
+                If(way == i, data_port.we.eq(data_we))
+            ]
+            data_ports.append(data_port)
+        self.comb += data_dat_r.eq(Array(port.dat_r for port in data_ports)[way])
+
+        # Write-back buffer, holding a dirty victim line and its address
+        wb_valid = Signal()
+        wb_data = Signal(dw_to*2**wordbits)
+        wb_adr = Signal(linebits + tagbits)
+        drain = Signal()
+        evict_data = Signal(dw_to*2**wordbits)
+        self.comb += \
+            If(drain,
+                evict_data.eq(wb_data)
+            ).Else(
+                evict_data.eq(data_dat_r)
+            )
+
+        # Line returned to the master: the refilled one on a read miss
+        # acked straight from the slave
+        refill_ack = Signal()
+        master_data = Signal(dw_to*2**wordbits)
+        if word is None:
+            self.comb += \
+                If(refill_ack,
+                    master_data.eq(slave.dat_r)
+                ).Else(
+                    master_data.eq(data_dat_r)
+                )
+        else:
+            self.comb += master_data.eq(data_dat_r)
 
         write_from_slave = Signal()
         if adr_offset is None:
             adr_offset_r = None
         else:
             adr_offset_r = Signal(offsetbits)
-            self.sync += adr_offset_r.eq(adr_offset)
+            self.sync += If(lookahead,
+                adr_offset_r.eq(next_offset)
+            ).Else(
+                adr_offset_r.eq(adr_offset)
+            )
 
         self.comb += [
-            data_port.adr.eq(adr_line),
             If(write_from_slave,
-                displacer(slave.dat_r, word, data_port.dat_w),
-                displacer(Replicate(1, dw_to//8), word, data_port.we)
+                displacer(slave.dat_r, word, data_dat_w),
+                displacer(Replicate(1, dw_to//8), word, data_we)
             ).Else(
-                data_port.dat_w.eq(Replicate(master.dat_w, max(dw_to//dw_from, 1))),
+                data_dat_w.eq(Replicate(master.dat_w, max(dw_to//dw_from, 1))),
                 If(master.cyc & master.stb & master.we & master.ack,
-                    displacer(master.sel, adr_offset, data_port.we, 2**offsetbits, reverse=True)
+                    displacer(master.sel, adr_offset, data_we, 2**offsetbits, reverse=True)
                 )
             ),
-            chooser(data_port.dat_r, word, slave.dat_w),
+            chooser(evict_data, word, slave.dat_w),
             slave.sel.eq(2**(dw_to//8)-1),
-            chooser(data_port.dat_r, adr_offset_r, master.dat_r, reverse=True)
+            chooser(master_data, adr_offset_r, master.dat_r, reverse=True)
         ]
 
 
-        # Tag memory
-        tag_layout = [("tag", tagbits), ("dirty", 1)]
-        tag_mem = Memory(layout_len(tag_layout), 2**linebits)
-        tag_port = tag_mem.get_port(write_capable=True)
-        self.specials += tag_mem, tag_port
-        tag_do = Record(tag_layout)
+        # Tag memories, one per way
+        tag_layout = [("tag", tagbits), ("dirty", 1), ("valid", 1)]
+        tag_we = Signal()
         tag_di = Record(tag_layout)
-        self.comb += [
-            tag_do.raw_bits().eq(tag_port.dat_r),
-            tag_port.dat_w.eq(tag_di.raw_bits())
-        ]
+        tag_dos = []
+        for i in range(ways):
+            tag_mem = Memory(layout_len(tag_layout), 2**linebits)
+            tag_port = tag_mem.get_port(write_capable=True)
+            self.specials += tag_mem, tag_port
+            tag_do = Record(tag_layout)
+            self.comb += [
+                tag_do.raw_bits().eq(tag_port.dat_r),
+                tag_port.dat_w.eq(tag_di.raw_bits()),
+                tag_port.adr.eq(line),
+                tag_port.we.eq(tag_we & (way == i))
+            ]
+            tag_dos.append(tag_do)
+        tag_do = Record(tag_layout)
+        self.comb += tag_do.raw_bits().eq(Array(t.raw_bits() for t in tag_dos)[way])
 
-        self.comb += [
-            tag_port.adr.eq(adr_line),
-            tag_di.tag.eq(adr_tag)
-        ]
+        self.comb += tag_di.tag.eq(adr_tag)
         if word is not None:
-            self.comb += slave.adr.eq(Cat(word, adr_line, tag_do.tag))
+            self.comb += \
+                If(drain,
+                    slave.adr.eq(Cat(word, wb_adr))
+                ).Else(
+                    slave.adr.eq(Cat(word, line, tag_do.tag))
+                )
+            # Lines are transferred as incrementing bursts from their first word
+            self.comb += \
+                If(word == 2**wordbits-1,
+                    slave.cti.eq(0b111)
+                ).Else(
+                    slave.cti.eq(0b010)
+                )
         else:
-            self.comb += slave.adr.eq(Cat(adr_line, tag_do.tag))
+            self.comb += \
+                If(drain,
+                    slave.adr.eq(wb_adr)
+                ).Else(
+                    slave.adr.eq(Cat(line, tag_do.tag))
+                )
+
+        # Hit detection
+        hits = Signal(ways)
+        hit_way = Signal(max=max(ways, 2))
+        self.comb += hits.eq(Cat(*[t.valid & (t.tag == adr_tag) for t in tag_dos]))
+        for i in reversed(range(ways)):
+            self.comb += If(hits[i], hit_way.eq(i))
+
+        # Replacement: an invalid way, or the pseudo-LRU one
+        victim = Signal(max=max(ways, 2))
+        victim_r = Signal(max=max(ways, 2))
+        victim_dirty = Signal()
+        self.comb += victim_dirty.eq(Array(t.valid & t.dirty for t in tag_dos)[victim])
+        plru_we = Signal()
+        if ways > 1:
+            plru_mem = Memory(ways - 1, 2**linebits)
+            plru_rport = plru_mem.get_port()
+            plru_wport = plru_mem.get_port(write_capable=True)
+            self.specials += plru_mem, plru_rport, plru_wport
+            self.comb += [
+                plru_rport.adr.eq(line),
+                # written back at the address of the access, while the
+                # read port may already look ahead
+                plru_wport.adr.eq(adr_line),
+                plru_wport.we.eq(plru_we)
+            ]
+            self.comb += _plru_update(plru_rport.dat_r, plru_wport.dat_w, way, ways)
+            for w, condition in _plru_victim(plru_rport.dat_r, ways):
+                self.comb += If(condition, victim.eq(w))
+            for i in reversed(range(ways)):
+                self.comb += If(~tag_dos[i].valid, victim.eq(i))
 
         # slave word computation, word_clr and word_inc will be simplified
         # at synthesis when wordbits=0
@@ -554,24 +902,108 @@ class Cache(Module):
             else:
                 return 1
 
+        # Maintenance requests, served when the master is not being serviced
+        flush_req = Signal()
+        invalidate_req = Signal()
+        writeback_req = Signal()
+        self.sync += [
+            If(self._flush.re, flush_req.eq(1)),
+            If(self._invalidate.re, invalidate_req.eq(1)),
+            If(self._writeback.re, writeback_req.eq(1))
+        ]
+
+        # Lines are addressed by Cat(line number, tag), in units of slave
+        # words for master addresses, of master words otherwise
+        lineaddrbits = linebits + tagbits
+        byte_shift = log2_int(dw_from//8) + offsetbits
+        range_first = Signal(lineaddrbits)
+        range_end = Signal(lineaddrbits + 1)
+        self.comb += [
+            range_first.eq(self._writeback_base.storage[byte_shift:]),
+            range_end.eq((self._writeback_base.storage + self._writeback_length.storage +
+                          2**byte_shift - 1)[byte_shift:])
+        ]
+
+        walk_keep = Signal()  # range writeback, lines stay valid
+        walk_match = Signal()  # only lines holding walk_adr are visited
+        walk_drop = Signal()  # invalidate, no writeback
+        walk_adr = Signal(lineaddrbits)
+        walk_count = Signal(linebits + 1)
+        walk_way = Signal(max=max(ways, 2))
+        self.comb += walk_line.eq(walk_adr[:linebits])
+        walk_hit = Signal()
+        self.comb += walk_hit.eq(tag_do.valid &
+            (~walk_match | (tag_do.tag == walk_adr[linebits:])))
+
         # Control FSM
         self.submodules.fsm = fsm = FSM(reset_state="IDLE")
+        self.comb += \
+            If(walk,
+                way.eq(walk_way)
+            ).Elif(fsm.ongoing("TEST_HIT"),
+                way.eq(hit_way)
+            ).Else(
+                way.eq(victim_r)
+            )
+
         fsm.act("IDLE",
-            If(master.cyc & master.stb,
+            word_clr.eq(1),
+            If(wb_valid & (flush_req | invalidate_req | writeback_req),
+                NextState("DRAIN")
+            ).Elif(flush_req | invalidate_req | writeback_req,
+                NextValue(walk_keep, ~flush_req & ~invalidate_req),
+                NextValue(walk_drop, ~flush_req & invalidate_req),
+                NextValue(walk_way, 0),
+                If(flush_req | invalidate_req |
+                   (range_end - range_first >= 2**linebits),
+                    # a range covering a whole way writes back all of the
+                    # dirty lines of the cache
+                    NextValue(walk_match, 0),
+                    NextValue(walk_adr, 0),
+                    NextValue(walk_count, 2**linebits)
+                ).Else(
+                    NextValue(walk_match, 1),
+                    NextValue(walk_adr, range_first),
+                    NextValue(walk_count, range_end - range_first)
+                ),
+                NextValue(flush_req, 0),
+                NextValue(invalidate_req, 0),
+                NextValue(writeback_req, 0),
+                NextState("WALK_READ")
+            ).Elif(master.cyc & master.stb,
                 NextState("TEST_HIT")
+            ).Elif(wb_valid,
+                NextState("DRAIN")
             )
         )
         fsm.act("TEST_HIT",
             word_clr.eq(1),
-            If(tag_do.tag == adr_tag,
+            If(~(master.cyc & master.stb),
+                # the master did not follow up a lookahead
+                NextState("IDLE")
+            ).Elif(~fresh,
+                # the master did not ask for the looked ahead address,
+                # the memories now read its own
+                NextState("TEST_HIT")
+            ).Elif(hits != 0,
                 master.ack.eq(1),
+                plru_we.eq(1),
                 If(master.we,
+                    tag_di.valid.eq(1),
                     tag_di.dirty.eq(1),
-                    tag_port.we.eq(1)
-                ),
-                NextState("IDLE")
+                    tag_we.eq(1),
+                    NextState("IDLE")
+                ).Else(
+                    lookahead.eq(pipelined),
+                    NextState("TEST_HIT" if pipelined else "IDLE")
+                )
             ).Else(
-                If(tag_do.dirty,
+                NextValue(victim_r, victim),
+                If(wb_valid & (victim_dirty | (wb_adr == Cat(adr_line, adr_tag))),
+                    # the buffer is needed for the victim, or holds the
+                    # line to refill
+                    NextState("DRAIN")
+                ).Elif(victim_dirty,
                     NextState("EVICT")
                 ).Else(
                     NextState("REFILL_WRTAG")
@@ -580,22 +1012,44 @@ class Cache(Module):
         )
 
         fsm.act("EVICT",
+            NextValue(wb_valid, 1),
+            NextValue(wb_data, data_dat_r),
+            NextValue(wb_adr, Cat(line, tag_do.tag)),
+            NextState("REFILL_WRTAG")
+        )
+        fsm.act("DRAIN",
+            drain.eq(1),
             slave.stb.eq(1),
             slave.cyc.eq(1),
             slave.we.eq(1),
             If(slave.ack,
                 word_inc.eq(1),
-                 If(word_is_last(word),
-                    NextState("REFILL_WRTAG")
+                If(word_is_last(word),
+                    NextValue(wb_valid, 0),
+                    NextState("IDLE")
                 )
             )
         )
         fsm.act("REFILL_WRTAG",
             # Write the tag first to set the slave address
-            tag_port.we.eq(1),
+            tag_di.valid.eq(1),
+            tag_we.eq(1),
             word_clr.eq(1),
             NextState("REFILL")
         )
+        if word is None:
+            # the line is a single slave word, holding the requested one
+            refill_done = \
+                If(master.we,
+                    NextState("TEST_HIT")
+                ).Else(
+                    refill_ack.eq(1),
+                    master.ack.eq(1),
+                    plru_we.eq(1),
+                    NextState("IDLE")
+                )
+        else:
+            refill_done = NextState("TEST_HIT")
         fsm.act("REFILL",
             slave.stb.eq(1),
             slave.cyc.eq(1),
@@ -604,13 +1058,64 @@ class Cache(Module):
                 write_from_slave.eq(1),
                 word_inc.eq(1),
                 If(word_is_last(word),
-                    NextState("TEST_HIT"),
+                    refill_done
                 ).Else(
                     NextState("REFILL")
                 )
             )
         )
 
+        # Maintenance walk: one way of one set per iteration, the tags are
+        # read in WALK_READ and tested in WALK_TEST
+        fsm.act("WALK_READ",
+            walk.eq(1),
+            If(walk_count == 0,
+                NextState("IDLE")
+            ).Else(
+                NextState("WALK_TEST")
+            )
+        )
+        fsm.act("WALK_TEST",
+            walk.eq(1),
+            word_clr.eq(1),
+            If(walk_hit & tag_do.dirty & ~walk_drop,
+                NextState("WALK_EVICT")
+            ).Else(
+                NextState("WALK_UPDATE")
+            )
+        )
+        fsm.act("WALK_EVICT",
+            walk.eq(1),
+            slave.stb.eq(1),
+            slave.cyc.eq(1),
+            slave.we.eq(1),
+            If(slave.ack,
+                word_inc.eq(1),
+                If(word_is_last(word),
+                    NextState("WALK_UPDATE")
+                )
+            )
+        )
+        fsm.act("WALK_UPDATE",
+            walk.eq(1),
+            # lines outside the range are left untouched
+            tag_we.eq(walk_hit),
+            tag_di.tag.eq(tag_do.tag),
+            tag_di.valid.eq(walk_keep),
+            tag_di.dirty.eq(0),
+            If(walk_way == ways - 1,
+                NextValue(walk_way, 0),
+                NextValue(walk_adr, walk_adr + 1),
+                NextValue(walk_count, walk_count - 1)
+            ).Else(
+                NextValue(walk_way, walk_way + 1)
+            ),
+            NextState("WALK_READ")
+        )
+        self.comb += self._busy.status.eq(flush_req | invalidate_req | writeback_req |
+            fsm.ongoing("WALK_READ") | fsm.ongoing("WALK_TEST") |
+            fsm.ongoing("WALK_EVICT") | fsm.ongoing("WALK_UPDATE"))
+
 
 class SRAM(Module):
     def __init__(self, mem_or_size, read_only=False, init=None, bus=None, data_width=32):
@@ -634,8 +1139,17 @@ class SRAM(Module):
             self.comb += [port.we[i].eq(self.bus.cyc & self.bus.stb & self.bus.we & self.bus.sel[i])
                 for i in range(bus_data_width//8)] # A granularity of 8 in 64-bits data bus would reuslt in 8 bytes, 8 WEs
         # address and data
+        # In an incrementing burst, the memory reads the address of the next
+        # beat while the current one is acked, so that beats are acked in
+        # consecutive cycles (registered feedback, no wait states).
+        burst = Signal()
         self.comb += [
-            port.adr.eq(self.bus.adr[:len(port.adr)]),
+            burst.eq(self.bus.cyc & self.bus.stb & (self.bus.cti == 0b010)),
+            If(burst & self.bus.ack & ~self.bus.we,
+                port.adr.eq(_burst_next(self.bus.adr, self.bus.bte))
+            ).Else(
+                port.adr.eq(self.bus.adr[:len(port.adr)])
+            ),
             self.bus.dat_r.eq(port.dat_r)
         ]
         if not read_only:
@@ -643,7 +1157,7 @@ class SRAM(Module):
         # generate ack
         self.sync += [
             self.bus.ack.eq(0),
-            If(self.bus.cyc & self.bus.stb & ~self.bus.ack, self.bus.ack.eq(1))
+            If(self.bus.cyc & self.bus.stb & (~self.bus.ack | burst), self.bus.ack.eq(1))
         ]
 
 
@@ -5,6 +5,7 @@
 #include <crc.h>
 #include <string.h>
 #include <irq.h>
+#include <lz4.h>
 
 #include <generated/mem.h>
 #include <generated/csr.h>
@@ -13,11 +14,14 @@
 #include <net/tftp.h>
 #include "sfl.h"
 #include "boot.h"
+#include "timeline.h"
 
 extern void boot_helper(unsigned int r1, unsigned int r2, unsigned int r3, unsigned int addr);
 
 static void __attribute__((noreturn)) boot(unsigned int r1, unsigned int r2, unsigned int r3, unsigned int addr)
 {
+	timeline_mark(BOOTTIME_JUMP);
+	timeline_print();
 	printf("Executing booted program.\n");
 	uart_sync();
 	irq_setmask(0);
@@ -66,8 +70,238 @@ static int check_ack(void)
 	return ACK_TIMEOUT;
 }
 
+/*
+ * Flash boot images (mkmscimg -f) start with a length word and a CRC32 of
+ * the payload. When FBI_FLAG_LZ4 is set in the length word, the payload is
+ * the unpacked length followed by an LZ4 block; it is staged in the upper
+ * half of main RAM and unpacked to MAIN_RAM_BASE.
+ *
+ * When FBI_FLAG_SEGMENTED is set (mkmscimg -f -s), the payload is a
+ * segment table built from the ELF program headers, followed by the file
+ * data of each segment padded to a word. Only the file data is stored;
+ * the rest of each segment (.bss) is cleared by the loader.
+ */
+#define FBI_FLAG_LZ4 0x80000000
+#define FBI_FLAG_SEGMENTED 0x40000000
+#define FBI_STAGING_BASE (MAIN_RAM_BASE + MAIN_RAM_SIZE/2)
+#define FBI_MAX_SEGMENTS 16
+
+struct fbi_segment {
+	unsigned int address;
+	unsigned int file_size;
+	unsigned int mem_size;
+};
+
+#if defined(FLASH_BOOT_ADDRESS) || defined(CSR_ETHMAC_BASE)
+static int unpack_image(const unsigned char *payload, unsigned int length)
+{
+	unsigned int unpacked_length;
+	int r;
+
+	unpacked_length = *(const unsigned int *)payload;
+	if((length < 4) || (unpacked_length > MAIN_RAM_SIZE/2)) {
+		printf("Error: Invalid unpacked image length 0x%08x\n", unpacked_length);
+		return 0;
+	}
+	r = lz4_decompress(payload + 4, length - 4,
+		(unsigned char *)MAIN_RAM_BASE, unpacked_length);
+	if(r != unpacked_length) {
+		printf("Error: Corrupted compressed image\n");
+		return 0;
+	}
+	printf("Unpacked %d bytes\n", r);
+	return 1;
+}
+
+/*
+ * Copies the segments of a segmented image to their load addresses and
+ * checks the CRC of the payload on the way, so that flash images are read
+ * only once. Segments must lie in main RAM, outside the payload itself.
+ */
+static int load_segments(const unsigned char *payload, unsigned int length,
+	unsigned int crc, unsigned int *entry)
+{
+	unsigned int header[2];
+	struct fbi_segment segments[FBI_MAX_SEGMENTS];
+	unsigned int nsegments;
+	const unsigned char *p, *end;
+	unsigned int got_crc;
+	unsigned int padding;
+	int i;
+
+	p = payload;
+	end = payload + length;
+	if(length < sizeof(header)) {
+		printf("Error: Truncated segment table\n");
+		return 0;
+	}
+	got_crc = memcpy_crc32(header, p, sizeof(header), 0);
+	p += sizeof(header);
+	nsegments = header[0];
+	if((nsegments > FBI_MAX_SEGMENTS) || (nsegments*sizeof(struct fbi_segment) > end - p)) {
+		printf("Error: Invalid segment count %d\n", nsegments);
+		return 0;
+	}
+	got_crc = memcpy_crc32(segments, p, nsegments*sizeof(struct fbi_segment), got_crc);
+	p += nsegments*sizeof(struct fbi_segment);
+
+	for(i=0;i<nsegments;i++) {
+		unsigned int address = segments[i].address;
+		unsigned int file_size = segments[i].file_size;
+		unsigned int mem_size = segments[i].mem_size;
+
+		if((file_size > mem_size) || (mem_size > MAIN_RAM_SIZE)
+		   || (address < MAIN_RAM_BASE)
+		   || (address - MAIN_RAM_BASE > MAIN_RAM_SIZE - mem_size)
+		   || ((address < (unsigned int)end) && (address + mem_size > (unsigned int)payload))) {
+			printf("Error: Segment %d (0x%08x, %d bytes) cannot be loaded\n",
+				i, address, mem_size);
+			return 0;
+		}
+		padding = -file_size & 3;
+		if(file_size + padding > end - p) {
+			printf("Error: Truncated segment %d\n", i);
+			return 0;
+		}
+		got_crc = memcpy_crc32((void *)address, p, file_size, got_crc);
+		p += file_size;
+		if(padding) {
+			unsigned char pad[3];
+
+			got_crc = memcpy_crc32(pad, p, padding, got_crc);
+			p += padding;
+		}
+		memset((void *)(address + file_size), 0, mem_size - file_size);
+		/* instruction fetches bypass the data cache */
+		flush_cpu_dcache_range((void *)address, mem_size);
+	}
+
+	if(p != end) {
+		printf("Error: Trailing data after segment %d\n", nsegments - 1);
+		return 0;
+	}
+	if(crc != got_crc) {
+		printf("CRC failed (expected %08x, got %08x)\n", crc, got_crc);
+		return 0;
+	}
+	printf("Loaded %d segments\n", nsegments);
+	*entry = header[1];
+	return 1;
+}
+#endif
+
 #define MAX_FAILED 5
 
+#ifdef CSR_UART_PHY_TUNING_WORD_ADDR
+static unsigned int default_tuning_word;
+
+/* Waits until the characters queued so far have left the UART,
+ * including those still held in the hardware FIFO. */
+static void uart_drain(void)
+{
+	uart_sync();
+	timer0_en_write(0);
+	timer0_reload_write(0);
+	timer0_load_write(CONFIG_CLOCK_FREQUENCY/100);
+	timer0_en_write(1);
+	timer0_update_value_write(1);
+	while(timer0_value_read())
+		timer0_update_value_write(1);
+}
+
+/* Returns 1 if a valid baud rate confirmation frame is received
+ * within one second */
+static int check_baudrate_confirm(unsigned int baudrate)
+{
+	struct sfl_frame frame;
+	unsigned char *p;
+	int i, length;
+	unsigned int got_baudrate;
+
+	while(uart_read_nonblock())
+		uart_read();
+
+	timer0_en_write(0);
+	timer0_reload_write(0);
+	timer0_load_write(CONFIG_CLOCK_FREQUENCY);
+	timer0_en_write(1);
+	timer0_update_value_write(1);
+
+	p = (unsigned char *)&frame;
+	length = 4;
+	for(i=0;i<length;i++) {
+		while(!uart_read_nonblock()) {
+			timer0_update_value_write(1);
+			if(!timer0_value_read())
+				return 0;
+		}
+		p[i] = uart_read();
+		if(i == 0)
+			length = 4 + frame.length;
+	}
+
+	if((((int)frame.crc[0] << 8)|(int)frame.crc[1]) != crc16(&frame.cmd, frame.length+1))
+		return 0;
+	if((frame.cmd != SFL_CMD_BAUDRATE) || (frame.length != 4))
+		return 0;
+	got_baudrate =  ((unsigned int)frame.payload[0] << 24)
+		       |((unsigned int)frame.payload[1] << 16)
+		       |((unsigned int)frame.payload[2] << 8)
+		       |((unsigned int)frame.payload[3] << 0);
+	return got_baudrate == baudrate;
+}
+
+/*
+ * At a negotiated baud rate, a host that went away or a rate that stopped
+ * working would leave the console stuck: go back to the default rate when
+ * no valid frame has been received for BAUDRATE_TIMEOUT seconds.
+ */
+#define BAUDRATE_TIMEOUT 2
+
+static void frame_timer_start(void)
+{
+	timer0_en_write(0);
+	timer0_reload_write(0);
+	timer0_load_write(CONFIG_CLOCK_FREQUENCY*BAUDRATE_TIMEOUT);
+	timer0_en_write(1);
+}
+#endif
+
+/* Returns 0 if the frame timer expired at a negotiated baud rate */
+static int read_frame(struct sfl_frame *frame)
+{
+	unsigned char *p;
+	int i, length;
+
+	p = (unsigned char *)frame;
+	length = 4;
+	for(i=0;i<length;i++) {
+#ifdef CSR_UART_PHY_TUNING_WORD_ADDR
+		if(uart_phy_tuning_word_read() != default_tuning_word) {
+			while(!uart_read_nonblock()) {
+				timer0_update_value_write(1);
+				if(!timer0_value_read())
+					return 0;
+			}
+		}
+#endif
+		p[i] = uart_read();
+		if(i == 0)
+			length = 4 + frame->length;
+	}
+	return 1;
+}
+
+static void restore_baudrate(void)
+{
+#ifdef CSR_UART_PHY_TUNING_WORD_ADDR
+	if(uart_phy_tuning_word_read() != default_tuning_word) {
+		uart_drain();
+		uart_phy_tuning_word_write(default_tuning_word);
+	}
+#endif
+}
+
 /* Returns 1 if other boot methods should be tried */
 int serialboot(void)
 {
@@ -78,6 +312,7 @@ int serialboot(void)
 	const char *c;
 	int ack_status;
 
+	timeline_mark(BOOTTIME_SERIALBOOT);
 	printf("Booting from serial...\n");
 	printf("Press Q or ESC to abort boot completely.\n");
 
@@ -96,7 +331,11 @@ int serialboot(void)
 		return 0;
 	}
 	/* assume ACK_OK */
+	timeline_mark(BOOTTIME_LOAD);
 
+#ifdef CSR_UART_PHY_TUNING_WORD_ADDR
+	default_tuning_word = uart_phy_tuning_word_read();
+#endif
 	failed = 0;
 	cmdline_adr = initrdstart_adr = initrdend_adr = 0;
 	while(1) {
@@ -105,12 +344,11 @@ int serialboot(void)
 		int goodcrc;
 
 		/* Grab one frame */
-		frame.length = uart_read();
-		frame.crc[0] = uart_read();
-		frame.crc[1] = uart_read();
-		frame.cmd = uart_read();
-		for(i=0;i<frame.length;i++)
-			frame.payload[i] = uart_read();
+		if(!read_frame(&frame)) {
+			restore_baudrate();
+			printf("Timeout at the negotiated baud rate, aborting\n");
+			return 1;
+		}
 
 		/* Check CRC */
 		actualcrc = ((int)frame.crc[0] << 8)|(int)frame.crc[1];
@@ -118,6 +356,7 @@ int serialboot(void)
 		if(actualcrc != goodcrc) {
 			failed++;
 			if(failed == MAX_FAILED) {
+				restore_baudrate();
 				printf("Too many consecutive errors, aborting");
 				return 1;
 			}
@@ -126,10 +365,14 @@ int serialboot(void)
 		}
 
 		/* CRC OK */
+#ifdef CSR_UART_PHY_TUNING_WORD_ADDR
+		frame_timer_start();
+#endif
 		switch(frame.cmd) {
 			case SFL_CMD_ABORT:
 				failed = 0;
 				uart_write(SFL_ACK_SUCCESS);
+				restore_baudrate();
 				return 1;
 			case SFL_CMD_LOAD: {
 				char *writepointer;
@@ -145,6 +388,46 @@ int serialboot(void)
 				uart_write(SFL_ACK_SUCCESS);
 				break;
 			}
+			case SFL_CMD_LOAD_LZ4: {
+				unsigned char *writepointer;
+				unsigned int unpacked_length;
+
+				failed = 0;
+				writepointer = (unsigned char *)(
+					 ((unsigned int)frame.payload[0] << 24)
+					|((unsigned int)frame.payload[1] << 16)
+					|((unsigned int)frame.payload[2] << 8)
+					|((unsigned int)frame.payload[3] << 0));
+				unpacked_length =  ((unsigned int)frame.payload[4] << 8)
+						  |((unsigned int)frame.payload[5] << 0);
+				if((frame.length < 6) ||
+				   (lz4_decompress(&frame.payload[6], frame.length - 6,
+						writepointer, unpacked_length) != unpacked_length))
+					uart_write(SFL_ACK_ERROR);
+				else
+					uart_write(SFL_ACK_SUCCESS);
+				break;
+			}
+			case SFL_CMD_ZERO: {
+				unsigned int address, length;
+
+				failed = 0;
+				address =  ((unsigned int)frame.payload[0] << 24)
+					  |((unsigned int)frame.payload[1] << 16)
+					  |((unsigned int)frame.payload[2] << 8)
+					  |((unsigned int)frame.payload[3] << 0);
+				length =  ((unsigned int)frame.payload[4] << 24)
+					 |((unsigned int)frame.payload[5] << 16)
+					 |((unsigned int)frame.payload[6] << 8)
+					 |((unsigned int)frame.payload[7] << 0);
+				if(frame.length != 8) {
+					uart_write(SFL_ACK_ERROR);
+					break;
+				}
+				memset((void *)address, 0, length);
+				uart_write(SFL_ACK_SUCCESS);
+				break;
+			}
 			case SFL_CMD_JUMP: {
 				unsigned int addr;
 
@@ -154,9 +437,42 @@ int serialboot(void)
 					|((unsigned int)frame.payload[2] << 8)
 					|((unsigned int)frame.payload[3] << 0);
 				uart_write(SFL_ACK_SUCCESS);
+				restore_baudrate();
 				boot(cmdline_adr, initrdstart_adr, initrdend_adr, addr);
 				break;
 			}
+#ifdef CSR_UART_PHY_TUNING_WORD_ADDR
+			case SFL_CMD_BAUDRATE: {
+				unsigned int baudrate;
+				unsigned int tuning_word;
+
+				failed = 0;
+				baudrate =  ((unsigned int)frame.payload[0] << 24)
+					   |((unsigned int)frame.payload[1] << 16)
+					   |((unsigned int)frame.payload[2] << 8)
+					   |((unsigned int)frame.payload[3] << 0);
+				if((frame.length != 4) || (baudrate == 0) || (baudrate > CONFIG_CLOCK_FREQUENCY/16)) {
+					uart_write(SFL_ACK_ERROR);
+					break;
+				}
+				uart_write(SFL_ACK_SUCCESS);
+				uart_drain();
+
+				/*
+				 * The host repeats the request at the new rate. If it does
+				 * not get through cleanly, go back to the previous rate; the
+				 * host falls back as well when it gets no acknowledgement.
+				 */
+				tuning_word = uart_phy_tuning_word_read();
+				uart_phy_tuning_word_write(((unsigned long long)baudrate << 32)/CONFIG_CLOCK_FREQUENCY);
+				if(check_baudrate_confirm(baudrate)) {
+					uart_write(SFL_ACK_SUCCESS);
+					frame_timer_start();
+				} else
+					uart_phy_tuning_word_write(tuning_word);
+				break;
+			}
+#endif
 			case SFL_CMD_CMDLINE:
 				failed = 0;
 				cmdline_adr =  ((unsigned int)frame.payload[0] << 24)
@@ -184,6 +500,7 @@ int serialboot(void)
 			default:
 				failed++;
 				if(failed == MAX_FAILED) {
+					restore_baudrate();
 					printf("Too many consecutive errors, aborting");
 					return 1;
 				}
@@ -205,11 +522,11 @@ int serialboot(void)
 #define REMOTEIP3 1
 #define REMOTEIP4 100
 
-static int tftp_get_v(unsigned int ip, const char *filename, char *buffer)
+static int tftp_get_v(unsigned int ip, const char *filename, char *buffer, int size)
 {
 	int r;
 
-	r = tftp_get(ip, filename, buffer);
+	r = tftp_get_max(ip, filename, buffer, size);
 	if(r > 0)
 		printf("Successfully downloaded %d bytes from %s over TFTP\n", r, filename);
 	else
@@ -219,12 +536,40 @@ static int tftp_get_v(unsigned int ip, const char *filename, char *buffer)
 
 static const unsigned char macadr[6] = {0x10, 0xe2, 0xd5, 0x00, 0x00, 0x00};
 
+static int load_fbi(const unsigned int *image, int size, unsigned int *entry)
+{
+	unsigned int length;
+	unsigned int crc;
+	unsigned int got_crc;
+
+	length = image[0] & ~(FBI_FLAG_LZ4|FBI_FLAG_SEGMENTED);
+	crc = image[1];
+	if(length + 8 != size) {
+		printf("Error: Invalid boot image length 0x%08x\n", length);
+		return 0;
+	}
+	*entry = MAIN_RAM_BASE;
+	if(image[0] & FBI_FLAG_SEGMENTED)
+		return load_segments((const unsigned char *)&image[2], length, crc, entry);
+	got_crc = crc32((const unsigned char *)&image[2], length);
+	if(crc != got_crc) {
+		printf("CRC failed (expected %08x, got %08x)\n", crc, got_crc);
+		return 0;
+	}
+	if(image[0] & FBI_FLAG_LZ4)
+		return unpack_image((const unsigned char *)&image[2], length);
+	memcpy((void *)MAIN_RAM_BASE, &image[2], length);
+	return 1;
+}
+
 void netboot(void)
 {
 	int size;
 	unsigned int cmdline_adr, initrdstart_adr, initrdend_adr;
 	unsigned int ip;
+	unsigned int entry;
 
+	timeline_mark(BOOTTIME_NETBOOT);
 	printf("Booting from network...\n");
 	printf("Local IP : %d.%d.%d.%d\n", LOCALIP1, LOCALIP2, LOCALIP3, LOCALIP4);
 	printf("Remote IP: %d.%d.%d.%d\n", REMOTEIP1, REMOTEIP2, REMOTEIP3, REMOTEIP4);
@@ -233,13 +578,27 @@ void netboot(void)
 
 	microudp_start(macadr, IPTOINT(LOCALIP1, LOCALIP2, LOCALIP3, LOCALIP4));
 
-	if(tftp_get_v(ip, "boot.bin", (void *)MAIN_RAM_BASE) <= 0) {
+	/* Prefer a (possibly compressed or segmented) flash boot image,
+	 * fall back to a raw binary */
+	timeline_mark(BOOTTIME_TFTP);
+	entry = MAIN_RAM_BASE;
+	/* the staging area is the upper half of the main RAM */
+	size = tftp_get_v(ip, "boot.fbi", (void *)FBI_STAGING_BASE, MAIN_RAM_SIZE/2);
+	if(size > 0) {
+		timeline_mark(BOOTTIME_LOAD);
+		if(!load_fbi((unsigned int *)FBI_STAGING_BASE, size, &entry)) {
+			printf("Network boot failed\n");
+			return;
+		}
+		timeline_mark(BOOTTIME_TFTP);
+	} else if(tftp_get_v(ip, "boot.bin", (void *)MAIN_RAM_BASE, MAIN_RAM_SIZE) <= 0) {
 		printf("Network boot failed\n");
 		return;
 	}
 
 	cmdline_adr = MAIN_RAM_BASE+0x1000000;
-	size = tftp_get_v(ip, "cmdline.txt", (void *)cmdline_adr);
+	size = tftp_get_v(ip, "cmdline.txt", (void *)cmdline_adr,
+		MAIN_RAM_BASE + MAIN_RAM_SIZE - cmdline_adr - 1);
 	if(size <= 0) {
 		printf("No command line parameters found\n");
 		cmdline_adr = 0;
@@ -247,7 +606,8 @@ void netboot(void)
 		*((char *)(cmdline_adr+size)) = 0x00;
 
 	initrdstart_adr = MAIN_RAM_BASE+0x1002000;
-	size = tftp_get_v(ip, "initrd.bin", (void *)initrdstart_adr);
+	size = tftp_get_v(ip, "initrd.bin", (void *)initrdstart_adr,
+		MAIN_RAM_BASE + MAIN_RAM_SIZE - initrdstart_adr);
 	if(size <= 0) {
 		printf("No initial ramdisk found\n");
 		initrdstart_adr = 0;
@@ -255,7 +615,7 @@ void netboot(void)
 	} else
 		initrdend_adr = initrdstart_adr + size;
 
-	boot(cmdline_adr, initrdstart_adr, initrdend_adr, MAIN_RAM_BASE);
+	boot(cmdline_adr, initrdstart_adr, initrdend_adr, entry);
 }
 
 #endif
@@ -267,23 +627,38 @@ void flashboot(void)
 	unsigned int length;
 	unsigned int crc;
 	unsigned int got_crc;
+	int compressed, segmented;
+	unsigned char *buffer;
+	unsigned int entry;
 
+	timeline_mark(BOOTTIME_FLASHBOOT);
 	printf("Booting from flash...\n");
 	flashbase = (unsigned int *)FLASH_BOOT_ADDRESS;
 	length = *flashbase++;
 	crc = *flashbase++;
+	compressed = !!(length & FBI_FLAG_LZ4);
+	segmented = !!(length & FBI_FLAG_SEGMENTED);
+	length &= ~(FBI_FLAG_LZ4|FBI_FLAG_SEGMENTED);
 	if((length < 32) || (length > 4*1024*1024)) {
 		printf("Error: Invalid flash boot image length 0x%08x\n", length);
 		return;
 	}
 
 	printf("Loading %d bytes from flash...\n", length);
-	memcpy((void *)MAIN_RAM_BASE, flashbase, length);
-	got_crc = crc32((unsigned char *)MAIN_RAM_BASE, length);
+	if(segmented) {
+		/* copied straight from flash to the load addresses */
+		if(!load_segments((unsigned char *)flashbase, length, crc, &entry))
+			return;
+		boot(0, 0, 0, entry);
+	}
+	buffer = compressed ? (unsigned char *)FBI_STAGING_BASE : (unsigned char *)MAIN_RAM_BASE;
+	got_crc = memcpy_crc32(buffer, flashbase, length, 0);
 	if(crc != got_crc) {
 		printf("CRC failed (expected %08x, got %08x)\n", crc, got_crc);
 		return;
 	}
+	if(compressed && !unpack_image(buffer, length))
+		return;
 	boot(0, 0, 0, MAIN_RAM_BASE);
 }
 #endif
@@ -13,7 +13,9 @@
 #include <net/microudp.h>
 
 #include "sdram.h"
+#include "memtest.h"
 #include "boot.h"
+#include "timeline.h"
 
 /* General address space functions */
 
@@ -306,6 +308,7 @@ static void help(void)
 	puts("mc         - copy address space");
 	puts("crc        - compute CRC32 of a part of the address space");
 	puts("ident      - display identifier");
+	puts("boottime   - display boot stage timings");
 #ifdef __lm32__
 	puts("rcsr       - read processor CSR");
 	puts("wcsr       - write processor CSR");
@@ -321,7 +324,8 @@ static void help(void)
 	puts("romboot    - boot from embedded rom");
 #endif
 #ifdef CSR_DFII_BASE
-	puts("memtest    - run a memory test");
+	puts("memtest    - run a memory test ('memtest full': all of main RAM,");
+	puts("             'memtest <march|walk|all> [offset] [length] [32|64]')");
 #endif
 }
 
@@ -352,6 +356,7 @@ static void do_command(char *c)
 	else if(strcmp(token, "mc") == 0) mc(get_token(&c), get_token(&c), get_token(&c));
 	else if(strcmp(token, "crc") == 0) crc(get_token(&c), get_token(&c));
 	else if(strcmp(token, "ident") == 0) ident();
+	else if(strcmp(token, "boottime") == 0) timeline_print();
 
 #ifdef CONFIG_L2_SIZE
 	else if(strcmp(token, "flushl2") == 0) flush_l2_cache();
@@ -388,9 +393,18 @@ static void do_command(char *c)
 	else if(strcmp(token, "sdrwlon") == 0) sdrwlon();
 	else if(strcmp(token, "sdrwloff") == 0) sdrwloff();
 #endif
-	else if(strcmp(token, "sdrlevel") == 0) sdrlevel();
+	else if(strcmp(token, "sdrlevel") == 0) sdrlevel(strcmp(get_token(&c), "parallel") == 0);
+	else if(strcmp(token, "sdreye") == 0) sdreye(get_token(&c));
 #endif
-	else if(strcmp(token, "memtest") == 0) memtest();
+	else if(strcmp(token, "memtest") == 0) {
+		token = get_token(&c);
+		if(strcmp(token, "") == 0)
+			memtest();
+		else if(strcmp(token, "full") == 0)
+			memtest_full();
+		else
+			memtest_patterns(token, get_token(&c), get_token(&c), get_token(&c));
+	}
 	else if(strcmp(token, "sdrinit") == 0) sdrinit();
 #endif
 
@@ -482,6 +496,7 @@ int main(int i, char **c)
 	char buffer[64];
 	int sdr_ok;
 
+	timeline_init();
 	irq_setmask(0);
 	irq_setie(1);
 	uart_init();
@@ -0,0 +1,175 @@
+#include <generated/csr.h>
+#ifdef CSR_DFII_BASE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <generated/mem.h>
+#include <system.h>
+
+#include "memtest.h"
+
+/*
+ * Pattern tests on a range of main RAM. Accesses go through the shadow
+ * region, so they bypass the CPU data cache; the L2 cache is still in the
+ * path and only holds CONFIG_L2_SIZE bytes of the range.
+ */
+
+#define MEMTEST_DEFAULT_LENGTH (2*1024*1024)
+
+#define MT_READ		0x1
+#define MT_WRITE	0x2
+
+/*
+ * One pass over the range. The background is all zeros (0) or all ones (1),
+ * with walk set a single bit of it is flipped, moving with the address.
+ */
+struct memtest_pass {
+	const char *name;
+	char down;
+	char op;
+	char r, w;
+	char walk;
+};
+
+static const struct memtest_pass march_c[] = {
+	{"w0",		0, MT_WRITE,		0, 0, 0},
+	{"up r0,w1",	0, MT_READ|MT_WRITE,	0, 1, 0},
+	{"up r1,w0",	0, MT_READ|MT_WRITE,	1, 0, 0},
+	{"down r0,w1",	1, MT_READ|MT_WRITE,	0, 1, 0},
+	{"down r1,w0",	1, MT_READ|MT_WRITE,	1, 0, 0},
+	{"r0",		0, MT_READ,		0, 0, 0},
+	{NULL}
+};
+
+static const struct memtest_pass walk[] = {
+	{"walk1 w",	0, MT_WRITE,		0, 0, 1},
+	{"walk1 r",	0, MT_READ,		0, 0, 1},
+	{"walk0 w",	0, MT_WRITE,		1, 1, 1},
+	{"walk0 r",	0, MT_READ,		1, 1, 1},
+	{NULL}
+};
+
+#define MEMTEST_RUN(bits, type) \
+static unsigned int run_##bits(volatile type *a, unsigned int n, const struct memtest_pass *p) \
+{ \
+	unsigned int i, j; \
+	unsigned int errors; \
+	type r, w; \
+\
+	errors = 0; \
+	for(i=0;i<n;i++) { \
+		j = p->down ? n - 1 - i : i; \
+		r = p->r ? ~(type)0 : 0; \
+		w = p->w ? ~(type)0 : 0; \
+		if(p->walk) { \
+			r ^= (type)1 << (j % bits); \
+			w ^= (type)1 << (j % bits); \
+		} \
+		if((p->op & MT_READ) && (a[j] != r)) \
+			errors++; \
+		if(p->op & MT_WRITE) \
+			a[j] = w; \
+	} \
+	return errors; \
+}
+
+MEMTEST_RUN(32, unsigned int)
+MEMTEST_RUN(64, unsigned long long int)
+
+#ifdef CSR_TIMER0_UPTIME_CYCLES_ADDR
+static unsigned long long int uptime(void)
+{
+	timer0_uptime_latch_write(1);
+	return timer0_uptime_cycles_read();
+}
+#endif
+
+static unsigned int run_passes(const struct memtest_pass *passes,
+	unsigned int base, unsigned int length, int width)
+{
+	const struct memtest_pass *p;
+	unsigned int errors, total;
+#ifdef CSR_TIMER0_UPTIME_CYCLES_ADDR
+	unsigned long long int start, cycles, bytes;
+#endif
+
+	total = 0;
+	for(p=passes;p->name != NULL;p++) {
+#ifdef CSR_TIMER0_UPTIME_CYCLES_ADDR
+		start = uptime();
+#endif
+		if(width == 64)
+			errors = run_64((volatile unsigned long long int *)base, length/8, p);
+		else
+			errors = run_32((volatile unsigned int *)base, length/4, p);
+		total += errors;
+		printf("  %-11s %8u errors", p->name, errors);
+#ifdef CSR_TIMER0_UPTIME_CYCLES_ADDR
+		cycles = uptime() - start;
+		bytes = length;
+		if(p->op == (MT_READ|MT_WRITE))
+			bytes *= 2;
+		if(cycles != 0)
+			printf("  %5u MB/s", (unsigned int)(bytes*CONFIG_CLOCK_FREQUENCY/cycles/1000000));
+#endif
+		printf("\n");
+	}
+	return total;
+}
+
+static int parse(const char *s, unsigned int *value)
+{
+	char *c;
+
+	if(*s == 0)
+		return 1;
+	*value = strtoul(s, &c, 0);
+	return *c == 0;
+}
+
+void memtest_patterns(char *test, char *offset, char *length, char *width)
+{
+	unsigned int _offset, _length, _width;
+	unsigned int errors;
+	unsigned int base;
+	int march, walking;
+
+	march = (strcmp(test, "march") == 0) || (strcmp(test, "all") == 0);
+	walking = (strcmp(test, "walk") == 0) || (strcmp(test, "all") == 0);
+	_offset = 0;
+	_length = MEMTEST_DEFAULT_LENGTH;
+	_width = 8*CONFIG_DATA_WIDTH_BYTES;
+	if((!march && !walking)
+	   || !parse(offset, &_offset) || !parse(length, &_length) || !parse(width, &_width)
+	   || ((_width != 32) && (_width != 64))
+	   || (_offset % 8) || (_length % 8)
+	   || (_offset > MAIN_RAM_SIZE) || (_length > MAIN_RAM_SIZE - _offset)) {
+		printf("memtest <march|walk|all> [offset] [length] [32|64]\n");
+		return;
+	}
+
+	base = (MAIN_RAM_BASE + _offset) | CONFIG_SHADOW_BASE;
+	printf("Testing 0x%08x-0x%08x, %d-bit accesses\n",
+		MAIN_RAM_BASE + _offset, MAIN_RAM_BASE + _offset + _length, _width);
+	errors = 0;
+	if(march) {
+		printf("March C-:\n");
+		errors += run_passes(march_c, base, _length, _width);
+	}
+	if(walking) {
+		printf("Walking ones/zeros:\n");
+		errors += run_passes(walk, base, _length, _width);
+	}
+
+	/* cached copies of the range are stale */
+	flush_cpu_dcache();
+
+	if(errors != 0)
+		printf("Memtest failed: %u errors\n", errors);
+	else
+		printf("Memtest OK\n");
+}
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef __MEMTEST_H
+#define __MEMTEST_H
+
+void memtest_patterns(char *test, char *offset, char *length, char *width);
+
+#endif /* __MEMTEST_H */
@@ -3,6 +3,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <crc.h>
+#include <id.h>
+#include <irq.h>
+#include <spiflash.h>
 
 #include <generated/sdram_phy.h>
 #include <generated/mem.h>
@@ -10,6 +16,7 @@
 #include <system.h>
 
 #include "sdram.h"
+#include "timeline.h"
 
 static void cdelay(int i)
 {
@@ -198,10 +205,125 @@ void sdrwr(char *startaddr)
 
 #ifdef CONFIG_KUSDDRPHY
 #define ERR_DDRPHY_DELAY 512
+#define DDRPHY_COARSE_STEP 16
 #else
 #define ERR_DDRPHY_DELAY 32
+#define DDRPHY_COARSE_STEP 4
 #endif
 
+#define DDRPHY_GROUPS (DFII_PIX_DATA_SIZE/2)
+
+/* Leveling results, as applied to the PHY */
+struct sdram_calibration {
+	unsigned int magic;
+	unsigned int ident_crc;
+	unsigned short write_delay[DDRPHY_GROUPS];
+	unsigned char high_skew[DDRPHY_GROUPS];
+	unsigned char bitslip[DDRPHY_GROUPS];
+	unsigned short read_delay[DDRPHY_GROUPS];
+	unsigned int crc;
+};
+
+static struct sdram_calibration calibration;
+
+/*
+ * Taps can only be reset or incremented, and checking a tap setting is much
+ * slower than moving the delay line. The leveling searches therefore
+ * advance DDRPHY_COARSE_STEP taps between checks and scan only the last
+ * step tap by tap.
+ */
+struct delay_line {
+	void (*reset)(void);
+	void (*inc)(void);
+	/* returns a bit mask of the DQ groups that pass the check */
+	unsigned int (*check)(void);
+};
+
+static void delay_set(const struct delay_line *line, int delay)
+{
+	int i;
+
+	line->reset();
+	for(i=0;i<delay;i++)
+		line->inc();
+}
+
+/*
+ * Returns the smallest delay in [start, ERR_DDRPHY_DELAY) at which the check
+ * of the DQ group gives value, or ERR_DDRPHY_DELAY if there is none. The
+ * delay line of the group is left at the returned delay. The result must
+ * not change back and forth within one coarse step.
+ */
+static int delay_search(const struct delay_line *line, int group, int start, int value)
+{
+	int lo, hi;
+	int i;
+
+	if(start >= ERR_DDRPHY_DELAY)
+		return ERR_DDRPHY_DELAY;
+	ddrphy_dly_sel_write(1 << group);
+	delay_set(line, start);
+	if(((line->check() >> group) & 1) == value)
+		return start;
+
+	/* coarse steps, the check fails at lo */
+	hi = start;
+	do {
+		if(hi == ERR_DDRPHY_DELAY - 1)
+			return ERR_DDRPHY_DELAY;
+		lo = hi;
+		hi = lo + DDRPHY_COARSE_STEP;
+		if(hi > ERR_DDRPHY_DELAY - 1)
+			hi = ERR_DDRPHY_DELAY - 1;
+		for(i=lo;i<hi;i++)
+			line->inc();
+	} while(((line->check() >> group) & 1) != value);
+
+	/* fine steps over (lo, hi) */
+	delay_set(line, lo);
+	while(++lo < hi) {
+		line->inc();
+		if(((line->check() >> group) & 1) == value)
+			return lo;
+	}
+	line->inc();
+	return hi;
+}
+
+/*
+ * Moves the delay lines of all DQ groups together in coarse steps. For each
+ * group, hint[group][k] is set to the last delay checked before the check
+ * first gives values[k], looking for values[k] only after values[k-1] has
+ * been seen. Hints that were not reached are left unchanged, so that the
+ * following per-group searches only have to refine one coarse step.
+ */
+static void delay_coarse_scan(const struct delay_line *line,
+	const int *values, int nvalues, int (*hint)[2])
+{
+	int found[DDRPHY_GROUPS];
+	int delay, prev;
+	unsigned int mask;
+	int g, i;
+
+	for(g=0;g<DDRPHY_GROUPS;g++)
+		found[g] = 0;
+	ddrphy_dly_sel_write((1 << DDRPHY_GROUPS) - 1);
+	line->reset();
+	prev = 0;
+	for(delay=0;delay<ERR_DDRPHY_DELAY;delay+=DDRPHY_COARSE_STEP) {
+		if(delay)
+			for(i=0;i<DDRPHY_COARSE_STEP;i++)
+				line->inc();
+		mask = line->check();
+		for(g=0;g<DDRPHY_GROUPS;g++)
+			if((found[g] < nvalues) && (((mask >> g) & 1) == values[found[g]])) {
+				hint[g][found[g]] = prev;
+				found[g]++;
+			}
+		prev = delay;
+	}
+}
+
 #ifdef CONFIG_DDRPHY_WLEVEL
 
 void sdrwlon(void)
@@ -220,63 +342,76 @@ void sdrwloff(void)
 	ddrphy_wlevel_en_write(0);
 }
 
-static int write_level(int *delay, int *high_skew)
+static void write_delay_reset(void)
+{
+	ddrphy_wdly_dq_rst_write(1);
+	ddrphy_wdly_dqs_rst_write(1);
+}
+
+static void write_delay_inc(void)
+{
+	ddrphy_wdly_dq_inc_write(1);
+	ddrphy_wdly_dqs_inc_write(1);
+}
+
+/* Groups that sample CK=1 on the DQS edge */
+static unsigned int write_level_check(void)
+{
+	unsigned int mask;
+	int g;
+
+	ddrphy_wlevel_strobe_write(1);
+	cdelay(10);
+	mask = 0;
+	for(g=0;g<DDRPHY_GROUPS;g++)
+		if(MMPTR(dfii_pix_rddata_addr[0]+CONFIG_DATA_WIDTH_BYTES*(DDRPHY_GROUPS-1-g)) != 0)
+			mask |= 1 << g;
+	return mask;
+}
+
+static const struct delay_line write_delay_line = {
+	.reset = write_delay_reset,
+	.inc = write_delay_inc,
+	.check = write_level_check
+};
+
+static int write_level(int *delay, int *high_skew, int parallel)
 {
+	/* CK=0 zone (at delay 0 unless the group has high skew), then CK=1 */
+	static const int values[] = {0, 1};
+	int hint[DDRPHY_GROUPS][2];
 	int i;
-	int dq_address;
-	unsigned char dq;
+	int start;
 	int ok;
 
 	printf("Write leveling: ");
 
 	sdrwlon();
 	cdelay(100);
-	for(i=0;i<DFII_PIX_DATA_SIZE/2;i++) {
-		dq_address = dfii_pix_rddata_addr[0]+CONFIG_DATA_WIDTH_BYTES*(DFII_PIX_DATA_SIZE/2-1-i);
+	for(i=0;i<DDRPHY_GROUPS;i++)
+		hint[i][0] = hint[i][1] = 0;
+	if(parallel)
+		delay_coarse_scan(&write_delay_line, values, 2, hint);
+	for(i=0;i<DDRPHY_GROUPS;i++) {
 		ddrphy_dly_sel_write(1 << i);
-		ddrphy_wdly_dq_rst_write(1);
-		ddrphy_wdly_dqs_rst_write(1);
-
-		delay[i] = 0;
-
-		ddrphy_wlevel_strobe_write(1);
-		cdelay(10);
-		dq = MMPTR(dq_address);
-		if(dq != 0) {
+		write_delay_reset();
+		high_skew[i] = (write_level_check() >> i) & 1;
+		if(high_skew[i]) {
 			/*
 			 * Assume this DQ group has between 1 and 2 bit times of skew.
 			 * Bring DQS into the CK=0 zone before continuing leveling.
 			 */
-			high_skew[i] = 1;
-			while(dq != 0) {
-				delay[i]++;
-				if(delay[i] >= ERR_DDRPHY_DELAY)
-					break;
-				ddrphy_wdly_dq_inc_write(1);
-				ddrphy_wdly_dqs_inc_write(1);
-				ddrphy_wlevel_strobe_write(1);
-				cdelay(10);
-				dq = MMPTR(dq_address);
-			 }
+			start = delay_search(&write_delay_line, i, hint[i][0], 0);
 		} else
-			high_skew[i] = 0;
-
-		while(dq == 0) {
-			delay[i]++;
-			if(delay[i] >= ERR_DDRPHY_DELAY)
-				break;
-			ddrphy_wdly_dq_inc_write(1);
-			ddrphy_wdly_dqs_inc_write(1);
-
-			ddrphy_wlevel_strobe_write(1);
-			cdelay(10);
-			dq = MMPTR(dq_address);
-		}
+			start = 0;
+		if(hint[i][1] > start)
+			start = hint[i][1];
+		delay[i] = delay_search(&write_delay_line, i, start, 1);
 	}
 	sdrwloff();
 
 	ok = 1;
-	for(i=DFII_PIX_DATA_SIZE/2-1;i>=0;i--) {
+	for(i=DDRPHY_GROUPS-1;i>=0;i--) {
 		printf("%2d%c ", delay[i], high_skew[i] ? '*' : ' ');
 		if(delay[i] >= ERR_DDRPHY_DELAY)
 			ok = 0;
@@ -292,11 +427,27 @@ static int write_level(int *delay, int *high_skew)
 
 #endif /* CONFIG_DDRPHY_WLEVEL */
 
+static void read_bitslip_group(int group)
+{
+	ddrphy_dly_sel_write(1 << group);
+#ifdef CONFIG_KUSDDRPHY
+	ddrphy_rdly_dq_bitslip_write(1);
+#else
+	/* 7-series SERDES in DDR mode needs 3 pulses for 1 bitslip */
+	ddrphy_rdly_dq_bitslip_write(1);
+	ddrphy_rdly_dq_bitslip_write(1);
+	ddrphy_rdly_dq_bitslip_write(1);
+#endif
+}
+
 static void read_bitslip(int *delay, int *high_skew)
 {
 	int bitslip_thr;
 	int i;
 
+	for(i=0;i<DFII_PIX_DATA_SIZE/2;i++)
+		calibration.bitslip[i] = 0;
+
 	bitslip_thr = 0x7fffffff;
 	for(i=0;i<DFII_PIX_DATA_SIZE/2;i++)
 		if(high_skew[i] && (delay[i] < bitslip_thr))
@@ -308,27 +459,58 @@ static void read_bitslip(int *delay, int *high_skew)
 	printf("Read bitslip: ");
 	for(i=DFII_PIX_DATA_SIZE/2-1;i>=0;i--)
 		if(delay[i] > bitslip_thr) {
-			ddrphy_dly_sel_write(1 << i);
-#ifdef CONFIG_KUSDDRPHY
-			ddrphy_rdly_dq_bitslip_write(1);
-#else
-			/* 7-series SERDES in DDR mode needs 3 pulses for 1 bitslip */
-			ddrphy_rdly_dq_bitslip_write(1);
-			ddrphy_rdly_dq_bitslip_write(1);
-			ddrphy_rdly_dq_bitslip_write(1);
-#endif
+			read_bitslip_group(i);
+			calibration.bitslip[i] = 1;
 			printf("%d ", i);
 		}
 	printf("\n");
 }
 
-static void read_delays(void)
+static unsigned char read_prs[DFII_NPHASES*DFII_PIX_DATA_SIZE];
+
+static void read_delay_reset(void)
+{
+	ddrphy_rdly_dq_rst_write(1);
+}
+
+static void read_delay_inc(void)
+{
+	ddrphy_rdly_dq_inc_write(1);
+}
+
+/* Groups that read back the test pattern correctly */
+static unsigned int read_check(void)
 {
+	unsigned int mask;
+	int p, i;
+
+	command_prd(DFII_COMMAND_CAS|DFII_COMMAND_CS|DFII_COMMAND_RDDATA);
+	cdelay(15);
+	mask = (1 << DDRPHY_GROUPS) - 1;
+	for(i=0;i<DDRPHY_GROUPS;i++)
+		for(p=0;p<DFII_NPHASES;p++) {
+			if(MMPTR(dfii_pix_rddata_addr[p]+CONFIG_DATA_WIDTH_BYTES*i) != read_prs[DFII_PIX_DATA_SIZE*p+i])
+				mask &= ~(1 << (DDRPHY_GROUPS-1-i));
+			if(MMPTR(dfii_pix_rddata_addr[p]+CONFIG_DATA_WIDTH_BYTES*(i+DDRPHY_GROUPS)) != read_prs[DFII_PIX_DATA_SIZE*p+i+DDRPHY_GROUPS])
+				mask &= ~(1 << (DDRPHY_GROUPS-1-i));
+		}
+	return mask;
+}
+
+static const struct delay_line read_delay_line = {
+	.reset = read_delay_reset,
+	.inc = read_delay_inc,
+	.check = read_check
+};
+
+static void read_delays(int parallel)
+{
+	static const int values[] = {1, 0};
+	int hint[DDRPHY_GROUPS][2];
 	unsigned int prv;
-	unsigned char prs[DFII_NPHASES*DFII_PIX_DATA_SIZE];
-	int p, i, j;
-	int working;
-	int delay, delay_min, delay_max;
+	int p, i, g;
+	int start;
+	int delay_min, delay_max;
 
 	printf("Read delays: ");
 
@@ -336,7 +518,7 @@ static void read_delays(void)
 	prv = 42;
 	for(i=0;i<DFII_NPHASES*DFII_PIX_DATA_SIZE;i++) {
 		prv = 1664525*prv + 1013904223;
-		prs[i] = prv;
+		read_prs[i] = prv;
 	}
 
 	/* Activate */
@@ -348,76 +530,42 @@ static void read_delays(void)
 	/* Write test pattern */
 	for(p=0;p<DFII_NPHASES;p++)
 		for(i=0;i<DFII_PIX_DATA_SIZE;i++)
-			MMPTR(dfii_pix_wrdata_addr[p]+CONFIG_DATA_WIDTH_BYTES*i) = prs[DFII_PIX_DATA_SIZE*p+i];
+			MMPTR(dfii_pix_wrdata_addr[p]+CONFIG_DATA_WIDTH_BYTES*i) = read_prs[DFII_PIX_DATA_SIZE*p+i];
 	dfii_piwr_address_write(0);
 	dfii_piwr_baddress_write(0);
 	command_pwr(DFII_COMMAND_CAS|DFII_COMMAND_WE|DFII_COMMAND_CS|DFII_COMMAND_WRDATA);
 
-	/* Calibrate each DQ in turn */
 	dfii_pird_address_write(0);
 	dfii_pird_baddress_write(0);
-	for(i=0;i<DFII_PIX_DATA_SIZE/2;i++) {
-		ddrphy_dly_sel_write(1 << (DFII_PIX_DATA_SIZE/2-i-1));
-		delay = 0;
+	for(g=0;g<DDRPHY_GROUPS;g++)
+		hint[g][0] = hint[g][1] = 0;
+	if(parallel)
+		delay_coarse_scan(&read_delay_line, values, 2, hint);
+
+	/* Calibrate each DQ in turn */
+	for(i=0;i<DDRPHY_GROUPS;i++) {
+		g = DDRPHY_GROUPS-i-1;
 
 		/* Find smallest working delay */
-		ddrphy_rdly_dq_rst_write(1);
-		while(1) {
-			command_prd(DFII_COMMAND_CAS|DFII_COMMAND_CS|DFII_COMMAND_RDDATA);
-			cdelay(15);
-			working = 1;
-			for(p=0;p<DFII_NPHASES;p++) {
-				if(MMPTR(dfii_pix_rddata_addr[p]+CONFIG_DATA_WIDTH_BYTES*i) != prs[DFII_PIX_DATA_SIZE*p+i])
-					working = 0;
-				if(MMPTR(dfii_pix_rddata_addr[p]+CONFIG_DATA_WIDTH_BYTES*(i+DFII_PIX_DATA_SIZE/2)) != prs[DFII_PIX_DATA_SIZE*p+i+DFII_PIX_DATA_SIZE/2])
-					working = 0;
-			}
-			if(working)
-				break;
-			delay++;
-			if(delay >= ERR_DDRPHY_DELAY)
-				break;
-			ddrphy_rdly_dq_inc_write(1);
-		}
-		delay_min = delay;
+		delay_min = delay_search(&read_delay_line, g, hint[g][0], 1);
 
 		/* Get a bit further into the working zone */
 #ifdef CONFIG_KUSDDRPHY
-		for(j=0;j<16;j++) {
-			delay += 1;
-			ddrphy_rdly_dq_inc_write(1);
-		}
+		start = delay_min + 16;
 #else
-		delay++;
-		ddrphy_rdly_dq_inc_write(1);
+		start = delay_min + 1;
 #endif
+		if(hint[g][1] > start)
+			start = hint[g][1];
 
 		/* Find largest working delay */
-		while(1) {
-			command_prd(DFII_COMMAND_CAS|DFII_COMMAND_CS|DFII_COMMAND_RDDATA);
-			cdelay(15);
-			working = 1;
-			for(p=0;p<DFII_NPHASES;p++) {
-				if(MMPTR(dfii_pix_rddata_addr[p]+CONFIG_DATA_WIDTH_BYTES*i) != prs[DFII_PIX_DATA_SIZE*p+i])
-					working = 0;
-				if(MMPTR(dfii_pix_rddata_addr[p]+CONFIG_DATA_WIDTH_BYTES*(i+DFII_PIX_DATA_SIZE/2)) != prs[DFII_PIX_DATA_SIZE*p+i+DFII_PIX_DATA_SIZE/2])
-					working = 0;
-			}
-			if(!working)
-				break;
-			delay++;
-			if(delay >= ERR_DDRPHY_DELAY)
-				break;
-			ddrphy_rdly_dq_inc_write(1);
-		}
-		delay_max = delay;
+		delay_max = delay_search(&read_delay_line, g, start, 0);
 
-		printf("%d:%02d-%02d  ", DFII_PIX_DATA_SIZE/2-i-1, delay_min, delay_max);
+		printf("%d:%02d-%02d  ", g, delay_min, delay_max);
 
 		/* Set delay to the middle */
-		ddrphy_rdly_dq_rst_write(1);
-		for(j=0;j<(delay_min+delay_max)/2;j++)
-			ddrphy_rdly_dq_inc_write(1);
+		calibration.read_delay[g] = (delay_min+delay_max)/2;
+		delay_set(&read_delay_line, calibration.read_delay[g]);
 	}
 
 	/* Precharge */
@@ -429,27 +577,318 @@ static void read_delays(void)
 	printf("completed\n");
 }
 
-int sdrlevel(void)
+#define EYE_PATTERNS 5
+#if ERR_DDRPHY_DELAY > 64
+#define EYE_TAPS_PER_COLUMN (ERR_DDRPHY_DELAY/64)
+#else
+#define EYE_TAPS_PER_COLUMN 1
+#endif
+#define EYE_COLUMNS (ERR_DDRPHY_DELAY/EYE_TAPS_PER_COLUMN)
+
+static const char *eye_pattern_names[EYE_PATTERNS] = {
+	"prbs", "clock", "55/aa", "walk1", "walk0"
+};
+
+/*
+ * Byte n of test pattern k, in DFII write buffer order. Each phase carries
+ * two beats, one in each half of its data.
+ */
+static unsigned char eye_pattern(int k, int n)
+{
+	int beat;
+
+	beat = 2*(n/DFII_PIX_DATA_SIZE) + ((n % DFII_PIX_DATA_SIZE) >= DDRPHY_GROUPS);
+	switch(k) {
+		case 0:
+			return (1664525*(n + 42) + 1013904223) >> 24;
+		case 1:
+			return (beat & 1) ? 0xff : 0x00;
+		case 2:
+			return (beat & 1) ? 0xaa : 0x55;
+		case 3:
+			return 1 << (beat % 8);
+		default:
+			return ~(1 << (beat % 8));
+	}
+}
+
+/* Bits of the DQ group that read back pattern k incorrectly */
+static unsigned char eye_check(int group, int k)
+{
+	unsigned char errors;
+	int p, i, n;
+
+	dfii_pird_address_write(8*k);
+	dfii_pird_baddress_write(0);
+	command_prd(DFII_COMMAND_CAS|DFII_COMMAND_CS|DFII_COMMAND_RDDATA);
+	cdelay(15);
+	errors = 0;
+	for(p=0;p<DFII_NPHASES;p++)
+		for(i=DDRPHY_GROUPS-1-group;i<DFII_PIX_DATA_SIZE;i+=DDRPHY_GROUPS) {
+			n = DFII_PIX_DATA_SIZE*p+i;
+			errors |= MMPTR(dfii_pix_rddata_addr[p]+CONFIG_DATA_WIDTH_BYTES*i) ^ eye_pattern(k, n);
+		}
+	return errors;
+}
+
+/*
+ * Sweeps the read delay of each DQ group over its whole range and prints,
+ * for every DQ bit, where all test patterns read back correctly ('-'),
+ * where some do ('+') and where none do ('X'), one column per
+ * EYE_TAPS_PER_COLUMN taps. The widest passing window of each bit and of
+ * each group is reported as its margin. Overwrites the start of row 0 of
+ * bank 0 and leaves the SDRAM under hardware control.
+ */
+void sdreye(char *count)
+{
+	unsigned char fail[EYE_COLUMNS], pass[EYE_COLUMNS];
+	int start[8], len[8], best_start[8], best_len[8];
+	int group_start, group_len, group_best_start, group_best_len;
+	int min_margin, min_group;
+	int reads;
+	char *c;
+	int g, b, k, j, p, i;
+	int delay;
+	unsigned char errors;
+
+	if(*count == 0)
+		reads = 1;
+	else {
+		reads = strtoul(count, &c, 0);
+		if((*c != 0) || (reads <= 0)) {
+			printf("sdreye [reads per pattern and tap]\n");
+			return;
+		}
+	}
+
+	dfii_control_write(DFII_CONTROL_CKE|DFII_CONTROL_ODT|DFII_CONTROL_RESET_N);
+
+	/* Precharge, then activate row 0 */
+	dfii_pi0_address_write(0x400);
+	dfii_pi0_baddress_write(0);
+	command_p0(DFII_COMMAND_RAS|DFII_COMMAND_WE|DFII_COMMAND_CS);
+	cdelay(15);
+	dfii_pi0_address_write(0);
+	dfii_pi0_baddress_write(0);
+	command_p0(DFII_COMMAND_RAS|DFII_COMMAND_CS);
+	cdelay(15);
+
+	/* Write one burst per pattern */
+	for(k=0;k<EYE_PATTERNS;k++) {
+		for(p=0;p<DFII_NPHASES;p++)
+			for(i=0;i<DFII_PIX_DATA_SIZE;i++)
+				MMPTR(dfii_pix_wrdata_addr[p]+CONFIG_DATA_WIDTH_BYTES*i) = eye_pattern(k, DFII_PIX_DATA_SIZE*p+i);
+		dfii_piwr_address_write(8*k);
+		dfii_piwr_baddress_write(0);
+		command_pwr(DFII_COMMAND_CAS|DFII_COMMAND_WE|DFII_COMMAND_CS|DFII_COMMAND_WRDATA);
+		cdelay(15);
+	}
+
+	printf("Read eye, %d taps per column, patterns:", EYE_TAPS_PER_COLUMN);
+	for(k=0;k<EYE_PATTERNS;k++)
+		printf(" %s", eye_pattern_names[k]);
+	printf("\n");
+
+	min_margin = ERR_DDRPHY_DELAY;
+	min_group = 0;
+	for(g=DDRPHY_GROUPS-1;g>=0;g--) {
+		for(j=0;j<EYE_COLUMNS;j++)
+			fail[j] = pass[j] = 0;
+		for(b=0;b<8;b++)
+			start[b] = len[b] = best_start[b] = best_len[b] = 0;
+		group_start = group_len = group_best_start = group_best_len = 0;
+
+		ddrphy_dly_sel_write(1 << g);
+		read_delay_reset();
+		for(delay=0;delay<ERR_DDRPHY_DELAY;delay++) {
+			if(delay)
+				read_delay_inc();
+			errors = 0;
+			for(k=0;k<EYE_PATTERNS;k++)
+				for(j=0;j<reads;j++)
+					errors |= eye_check(g, k);
+			fail[delay/EYE_TAPS_PER_COLUMN] |= errors;
+			pass[delay/EYE_TAPS_PER_COLUMN] |= ~errors;
+
+			/* track the widest passing window of each bit and of the group */
+			for(b=0;b<8;b++) {
+				if(errors & (1 << b))
+					len[b] = 0;
+				else if(len[b]++ == 0)
+					start[b] = delay;
+				if(len[b] > best_len[b]) {
+					best_start[b] = start[b];
+					best_len[b] = len[b];
+				}
+			}
+			if(errors)
+				group_len = 0;
+			else if(group_len++ == 0)
+				group_start = delay;
+			if(group_len > group_best_len) {
+				group_best_start = group_start;
+				group_best_len = group_len;
+			}
+		}
+
+		for(b=7;b>=0;b--) {
+			printf("DQ%-3d ", 8*g+b);
+			for(j=0;j<EYE_COLUMNS;j++) {
+				if(!(fail[j] & (1 << b)))
+					printf("-");
+				else if(pass[j] & (1 << b))
+					printf("+");
+				else
+					printf("X");
+			}
+			printf(" %3d-%3d (%d)\n", best_start[b], best_start[b] + best_len[b] - 1, best_len[b]);
+		}
+		printf("group %d: %d-%d (%d taps)\n", g,
+			group_best_start, group_best_start + group_best_len - 1, group_best_len);
+		if(group_best_len < min_margin) {
+			min_margin = group_best_len;
+			min_group = g;
+		}
+
+		/* back to the leveled delay */
+		delay_set(&read_delay_line, calibration.read_delay[g]);
+	}
+	printf("Minimum margin: %d taps (group %d)\n", min_margin, min_group);
+
+	/* Precharge */
+	dfii_pi0_address_write(0);
+	dfii_pi0_baddress_write(0);
+	command_p0(DFII_COMMAND_RAS|DFII_COMMAND_WE|DFII_COMMAND_CS);
+	cdelay(15);
+
+	dfii_control_write(DFII_CONTROL_SEL);
+}
+
+/*
+ * With parallel set, all DQ groups are first swept together in coarse steps
+ * (each check reads back every group), so that the per-group searches only
+ * refine the edges they found.
+ */
+int sdrlevel(int parallel)
 {
 	int delay[DFII_PIX_DATA_SIZE/2];
 	int high_skew[DFII_PIX_DATA_SIZE/2];
 
-#ifndef CONFIG_DDRPHY_WLEVEL
 	int i;
+
+#ifndef CONFIG_DDRPHY_WLEVEL
 	for(i=0; i<DFII_PIX_DATA_SIZE/2; i++) {
 		delay[i] = 0;
 		high_skew[i] = 0;
 	}
 #else
-	if(!write_level(delay, high_skew))
+	if(!write_level(delay, high_skew, parallel))
 		return 0;
 #endif
+	for(i=0; i<DFII_PIX_DATA_SIZE/2; i++) {
+		calibration.write_delay[i] = delay[i];
+		calibration.high_skew[i] = high_skew[i];
+	}
 	read_bitslip(delay, high_skew);
-	read_delays();
+	read_delays(parallel);
 
 	return 1;
 }
 
+#if defined(CONFIG_SDRAM_CALIBRATION_ADDRESS) && defined(CSR_SPIFLASH_BASE) && defined(CONFIG_SPIFLASH_PAGE_SIZE)
+/*
+ * Leveling results are stored in a flash sector and restored at the next boot
+ * of the same gateware. A memory test decides whether they are still good,
+ * otherwise leveling is run again.
+ *
+ * The sector is erased at every save, so this is only enabled by targets that
+ * reserve one for it: self.config["SDRAM_CALIBRATION_ADDRESS"], the address
+ * of that sector in the CPU address space.
+ */
+#define SDRAM_CALIBRATION_ADDRESS CONFIG_SDRAM_CALIBRATION_ADDRESS
+#define SDRAM_CALIBRATION_MAGIC 0x5344434c /* "SDCL" */
+
+static unsigned int ident_crc(void)
+{
+	char ident[IDENT_SIZE];
+
+	get_ident(ident);
+	return crc32((unsigned char *)ident, strlen(ident));
+}
+
+static int sdrcal_restore(void)
+{
+	const struct sdram_calibration *stored;
+	unsigned int e;
+	int i;
+
+	stored = (const struct sdram_calibration *)SDRAM_CALIBRATION_ADDRESS;
+	if((stored->magic != SDRAM_CALIBRATION_MAGIC)
+	   || (stored->ident_crc != ident_crc())
+	   || (stored->crc != crc32((const unsigned char *)stored, offsetof(struct sdram_calibration, crc))))
+		return 0;
+	memcpy(&calibration, stored, sizeof(calibration));
+
+	/* same order as leveling: resetting the write delays clears the bitslip */
+	printf("Restoring SDRAM calibration: ");
+	for(i=0;i<DDRPHY_GROUPS;i++) {
+#ifdef CONFIG_DDRPHY_WLEVEL
+		ddrphy_dly_sel_write(1 << i);
+		delay_set(&write_delay_line, calibration.write_delay[i]);
+#endif
+		if(calibration.bitslip[i])
+			read_bitslip_group(i);
+		ddrphy_dly_sel_write(1 << i);
+		delay_set(&read_delay_line, calibration.read_delay[i]);
+	}
+	for(i=DDRPHY_GROUPS-1;i>=0;i--)
+		printf("%d:%d%c/%d ", i, calibration.write_delay[i],
+			calibration.bitslip[i] ? '*' : ' ', calibration.read_delay[i]);
+	printf("\n");
+
+	dfii_control_write(DFII_CONTROL_SEL);
+	timeline_mark(BOOTTIME_MEMTEST);
+	e = memtest_silent();
+	if(e != 0) {
+		printf("Memtest failed with stored calibration, leveling again\n");
+		dfii_control_write(DFII_CONTROL_CKE|DFII_CONTROL_ODT|DFII_CONTROL_RESET_N);
+		init_sequence();
+		timeline_mark(BOOTTIME_SDRAM_LEVELING);
+		return 0;
+	}
+	printf("Memtest OK\n");
+	return 1;
+}
+
+extern char _framtext[], _eramtext[], _framtext_lma[];
+
+static void sdrcal_save(void)
+{
+	/*
+	 * The BIOS usually runs from the flash, which cannot be read while it is
+	 * programmed: call the flash code from its copy in SRAM (see bios.ld),
+	 * with interrupts off. The pointers keep the calls absolute.
+	 */
+	void (*volatile erase)(unsigned int) = erase_flash_sector;
+	void (*volatile write)(unsigned int, const unsigned char *, unsigned int) = write_to_flash;
+	unsigned int ie;
+
+	calibration.magic = SDRAM_CALIBRATION_MAGIC;
+	calibration.ident_crc = ident_crc();
+	calibration.crc = crc32((const unsigned char *)&calibration, offsetof(struct sdram_calibration, crc));
+
+	memcpy(_framtext, _framtext_lma, _eramtext - _framtext);
+	flush_cpu_icache();
+	ie = irq_getie();
+	irq_setie(0);
+	erase(SDRAM_CALIBRATION_ADDRESS);
+	write(SDRAM_CALIBRATION_ADDRESS, (const unsigned char *)&calibration, sizeof(calibration));
+	irq_setie(ie);
+	flush_cpu_dcache();
+	printf("SDRAM calibration saved to flash\n");
+}
+#endif
+
 #endif /* CSR_DDRPHY_BASE */
 
 #define TEST_DATA_SIZE (2*1024*1024)
@@ -557,18 +996,84 @@ int memtest(void)
 	}
 }
 
+#ifdef CSR_SDRAM_TESTER_BASE
+static unsigned int sweep_speed(unsigned int cycles)
+{
+	if(cycles == 0)
+		return 0;
+	return (unsigned long long int)MAIN_RAM_SIZE*CONFIG_CLOCK_FREQUENCY/cycles/1000000;
+}
+
+/*
+ * Writes a pseudo-random sequence to all of main RAM and reads it back with
+ * the SDRAM tester, bypassing the caches. Main RAM contents are lost.
+ */
+int memtest_full(void)
+{
+	unsigned int cycles, errors;
+
+	printf("Testing %d MiB of main RAM...\n", MAIN_RAM_SIZE/(1024*1024));
+
+	/* write back dirty lines before the tester overwrites them */
+	flush_cpu_dcache();
+	flush_l2_cache();
+
+	sdram_tester_writer_base_write(0);
+	sdram_tester_writer_length_write(MAIN_RAM_SIZE);
+	sdram_tester_writer_start_write(1);
+	while(sdram_tester_writer_busy_read());
+	cycles = sdram_tester_writer_cycles_read();
+	printf("Write: %u cycles, %u MB/s\n", cycles, sweep_speed(cycles));
+
+	sdram_tester_reader_base_write(0);
+	sdram_tester_reader_length_write(MAIN_RAM_SIZE);
+	sdram_tester_reader_start_write(1);
+	while(sdram_tester_reader_busy_read());
+	cycles = sdram_tester_reader_cycles_read();
+	errors = sdram_tester_reader_error_count_read();
+	printf("Read:  %u cycles, %u MB/s\n", cycles, sweep_speed(cycles));
+
+	/* the cached lines are stale now */
+	flush_l2_cache();
+	flush_cpu_dcache();
+
+	if(errors != 0) {
+		printf("Memtest failed: %u bus words incorrect\n", errors);
+		return 0;
+	}
+	printf("Memtest OK\n");
+	return 1;
+}
+#else
+int memtest_full(void)
+{
+	printf("Full memory test not available (no SDRAM tester)\n");
+	return 0;
+}
+#endif
+
 int sdrinit(void)
 {
 	printf("Initializing SDRAM...\n");
 
+	timeline_mark(BOOTTIME_SDRAM_INIT);
 	init_sequence();
 #ifdef CSR_DDRPHY_BASE
-	if(!sdrlevel())
+	timeline_mark(BOOTTIME_SDRAM_LEVELING);
+#ifdef SDRAM_CALIBRATION_ADDRESS
+	if(sdrcal_restore())
+		return 1;
+#endif
+	if(!sdrlevel(SDRAM_PARALLEL_LEVELING))
 		return 0;
 #endif
 	dfii_control_write(DFII_CONTROL_SEL);
+	timeline_mark(BOOTTIME_MEMTEST);
 	if(!memtest())
 		return 0;
+#ifdef SDRAM_CALIBRATION_ADDRESS
+	sdrcal_save();
+#endif
 
 	return 1;
 }
@@ -12,13 +12,20 @@ void sdrrderr(char *count);
 void sdrwr(char *startaddr);
 
 #ifdef CSR_DDRPHY_BASE
+/* Level all DQ groups at once in sdrinit(), see sdrlevel() */
+#ifndef SDRAM_PARALLEL_LEVELING
+#define SDRAM_PARALLEL_LEVELING 0
+#endif
+
 void sdrwlon(void);
 void sdrwloff(void);
-int sdrlevel(void);
+int sdrlevel(int parallel);
+void sdreye(char *count);
 #endif
 
 int memtest_silent(void);
 int memtest(void);
+int memtest_full(void);
 int sdrinit(void);
 
 #endif /* __SDRAM_H */
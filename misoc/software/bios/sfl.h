@@ -16,6 +16,9 @@ struct sfl_frame {
 #define SFL_CMD_ABORT		0x00
 #define SFL_CMD_LOAD		0x01
 #define SFL_CMD_JUMP		0x02
+#define SFL_CMD_BAUDRATE	0x06
+#define SFL_CMD_LOAD_LZ4	0x07
+#define SFL_CMD_ZERO		0x08
 
 /* Linux-specific commands */
 #define SFL_CMD_CMDLINE		0x03
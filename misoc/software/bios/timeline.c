@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <boottime.h>
+
+#include <generated/csr.h>
+
+#include "timeline.h"
+
+#ifdef CSR_TIMER0_UPTIME_CYCLES_ADDR
+
+/* placed at BOOTTIME_ADDRESS by the linker script */
+static struct boottime_table table __attribute__((section(".boottime")));
+
+static const char *stage_names[BOOTTIME_STAGE_COUNT] = {
+	[BOOTTIME_BIOS]			= "bios",
+	[BOOTTIME_SDRAM_INIT]		= "sdram init",
+	[BOOTTIME_SDRAM_LEVELING]	= "sdram leveling",
+	[BOOTTIME_MEMTEST]		= "memtest",
+	[BOOTTIME_SERIALBOOT]		= "serial boot",
+	[BOOTTIME_FLASHBOOT]		= "flash boot",
+	[BOOTTIME_NETBOOT]		= "net boot",
+	[BOOTTIME_TFTP]			= "tftp",
+	[BOOTTIME_LOAD]			= "load",
+	[BOOTTIME_JUMP]			= "jump"
+};
+
+void timeline_init(void)
+{
+	table.magic = BOOTTIME_MAGIC;
+	table.clock_frequency = CONFIG_CLOCK_FREQUENCY;
+	table.count = 0;
+	timeline_mark(BOOTTIME_BIOS);
+}
+
+void timeline_mark(unsigned int stage)
+{
+	unsigned long long int cycles;
+	struct boottime_event *event;
+
+	timer0_uptime_latch_write(1);
+	cycles = timer0_uptime_cycles_read();
+	/* when the table is full, the last event is overwritten */
+	if(table.count < BOOTTIME_MAX_EVENTS)
+		table.count++;
+	event = &table.events[table.count-1];
+	event->stage = stage;
+	event->cycles_hi = cycles >> 32;
+	event->cycles_lo = cycles;
+}
+
+static unsigned int event_us(unsigned int i)
+{
+	unsigned long long int cycles;
+
+	cycles = ((unsigned long long int)table.events[i].cycles_hi << 32)
+		|table.events[i].cycles_lo;
+	return cycles*1000000ULL/CONFIG_CLOCK_FREQUENCY;
+}
+
+void timeline_print(void)
+{
+	unsigned int i;
+	unsigned int start, duration;
+
+	printf("Boot timeline (ms):\n");
+	printf("     start   duration  stage\n");
+	for(i=0;i<table.count;i++) {
+		start = event_us(i);
+		printf("%6u.%03u ", start/1000, start%1000);
+		if(i + 1 < table.count) {
+			duration = event_us(i+1) - start;
+			printf("%6u.%03u  ", duration/1000, duration%1000);
+		} else
+			printf("         -  ");
+		if(table.events[i].stage < BOOTTIME_STAGE_COUNT)
+			printf("%s\n", stage_names[table.events[i].stage]);
+		else
+			printf("%u\n", table.events[i].stage);
+	}
+}
+
+#else
+
+void timeline_init(void)
+{
+}
+
+void timeline_mark(unsigned int stage)
+{
+}
+
+void timeline_print(void)
+{
+	printf("Boot timeline not available (no uptime counter)\n");
+}
+
+#endif
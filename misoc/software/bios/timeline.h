@@ -0,0 +1,10 @@
+#ifndef __TIMELINE_H
+#define __TIMELINE_H
+
+#include <boottime.h>
+
+void timeline_init(void);
+void timeline_mark(unsigned int stage);
+void timeline_print(void);
+
+#endif /* __TIMELINE_H */
@@ -0,0 +1,51 @@
+#ifndef __BOOTTIME_H
+#define __BOOTTIME_H
+
+#include <generated/mem.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The BIOS records when each boot stage starts in a table at the beginning
+ * of the integrated SRAM, where the booted firmware can read it. Timestamps
+ * are clock cycles since the FPGA was configured, taken from the uptime
+ * counter of timer0. A stage lasts until the start of the next event.
+ */
+#define BOOTTIME_ADDRESS SRAM_BASE
+#define BOOTTIME_MAGIC 0x42544d31 /* "BTM1" */
+#define BOOTTIME_MAX_EVENTS 16
+
+enum {
+	BOOTTIME_BIOS,		/* BIOS entered main() */
+	BOOTTIME_SDRAM_INIT,	/* SDRAM initialization sequence */
+	BOOTTIME_SDRAM_LEVELING,
+	BOOTTIME_MEMTEST,
+	BOOTTIME_SERIALBOOT,	/* waiting for the serial boot handshake */
+	BOOTTIME_FLASHBOOT,
+	BOOTTIME_NETBOOT,	/* network setup */
+	BOOTTIME_TFTP,		/* TFTP transfers */
+	BOOTTIME_LOAD,		/* image transfer, check and copy */
+	BOOTTIME_JUMP,		/* jump to the booted program */
+	BOOTTIME_STAGE_COUNT
+};
+
+struct boottime_event {
+	unsigned int stage;
+	unsigned int cycles_hi;
+	unsigned int cycles_lo;
+};
+
+struct boottime_table {
+	unsigned int magic;
+	unsigned int clock_frequency;
+	unsigned int count;
+	struct boottime_event events[BOOTTIME_MAX_EVENTS];
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
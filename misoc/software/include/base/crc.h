@@ -7,6 +7,7 @@ extern "C" {
 
 unsigned short crc16(const unsigned char *buffer, int len);
 unsigned int crc32(const unsigned char *buffer, unsigned int len);
+unsigned int memcpy_crc32(void *dest, const void *src, unsigned int len, unsigned int crc);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,29 @@
+#ifndef __DMA_H
+#define __DMA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Copies and fills by the DMA engine. The _start functions return 1 if the
+ * engine is moving the data, in which case the destination must not be
+ * accessed until dma_wait() has returned, or 0 if the CPU already did the
+ * work (no engine, short or incompatibly aligned buffers). The engine
+ * raises its "done" event at the end of a transfer.
+ */
+int dma_memcpy_start(void *dest, const void *src, size_t n);
+int dma_memset_start(void *dest, int c, size_t n);
+int dma_busy(void);
+void dma_wait(void);
+
+void *dma_memcpy(void *dest, const void *src, size_t n);
+void *dma_memset(void *dest, int c, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DMA_H */
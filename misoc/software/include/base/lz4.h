@@ -0,0 +1,15 @@
+#ifndef __LZ4_H
+#define __LZ4_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int lz4_decompress(const unsigned char *src, unsigned int src_len,
+	unsigned char *dst, unsigned int dst_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,7 +7,12 @@ extern "C" {
 
 void flush_cpu_icache(void);
 void flush_cpu_dcache(void);
+/* write back the cached lines of a range, e.g. before a DMA read */
+void flush_cpu_dcache_range(void *addr, unsigned int len);
+/* drop the cached lines of a range, e.g. after a DMA write */
+void invalidate_cpu_dcache_range(void *addr, unsigned int len);
 void flush_l2_cache(void);
+void writeback_l2_cache_range(void *addr, unsigned int len);
 
 #ifdef __or1k__
 #include <spr-defs.h>
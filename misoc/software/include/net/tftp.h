@@ -4,6 +4,8 @@
 #include <stdint.h>
 
 int tftp_get(uint32_t ip, const char *filename, void *buffer);
+/* fails, and writes nothing past buffer+size, if the file is larger */
+int tftp_get_max(uint32_t ip, const char *filename, void *buffer, int size);
 int tftp_put(uint32_t ip, const char *filename, const void *buffer, int size);
 
 #endif /* __TFTP_H */
@@ -79,3 +79,47 @@ unsigned int crc32(const unsigned char *buffer, unsigned int len)
 	} while(--len);
 	return crc ^ 0xffffffffL;
 }
+
+/*
+ * Copies len bytes from src to dest and returns the CRC32 of the data,
+ * reading the source only once. Word-aligned buffers are moved one word
+ * at a time. crc is the CRC32 of the data preceding src (0 if none), so
+ * that a buffer can be copied in several pieces.
+ */
+unsigned int memcpy_crc32(void *dest, const void *src, unsigned int len, unsigned int crc)
+{
+	unsigned char *d = dest;
+	const unsigned char *s = src;
+
+	crc = crc ^ 0xffffffffL;
+	if(!(((unsigned long)d | (unsigned long)s) & 3)) {
+		unsigned int *dw = (unsigned int *)d;
+		const unsigned int *sw = (const unsigned int *)s;
+		unsigned int w;
+
+		while(len >= 4) {
+			w = *sw++;
+			*dw++ = w;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			crc = crc_table[(crc ^ w) & 0xff] ^ (crc >> 8);
+			crc = crc_table[(crc ^ (w >> 8)) & 0xff] ^ (crc >> 8);
+			crc = crc_table[(crc ^ (w >> 16)) & 0xff] ^ (crc >> 8);
+			crc = crc_table[(crc ^ (w >> 24)) & 0xff] ^ (crc >> 8);
+#else
+			crc = crc_table[(crc ^ (w >> 24)) & 0xff] ^ (crc >> 8);
+			crc = crc_table[(crc ^ (w >> 16)) & 0xff] ^ (crc >> 8);
+			crc = crc_table[(crc ^ (w >> 8)) & 0xff] ^ (crc >> 8);
+			crc = crc_table[(crc ^ w) & 0xff] ^ (crc >> 8);
+#endif
+			len -= 4;
+		}
+		d = (unsigned char *)dw;
+		s = (const unsigned char *)sw;
+	}
+	while(len--) {
+		*d = *s;
+		crc = crc_table[((int)crc ^ (*s++)) & 0xff] ^ (crc >> 8);
+		d++;
+	}
+	return crc ^ 0xffffffffL;
+}
@@ -0,0 +1,121 @@
+#include <string.h>
+#include <dma.h>
+#include <system.h>
+
+#include <generated/csr.h>
+
+#ifdef CSR_DMA_BASE
+
+/* below this, programming the engine costs more than the copy */
+#define DMA_MIN_LENGTH 64
+#define DMA_ALIGN CONFIG_DATA_WIDTH_BYTES
+
+/* destination of the running transfer, stale in the CPU data cache */
+static void *dma_dest;
+static size_t dma_length;
+
+static void dma_start(void *dest, size_t n)
+{
+	flush_cpu_dcache_range(dest, n);
+	dma_dest = dest;
+	dma_length = n;
+	dma_destination_write((unsigned int)dest);
+	dma_length_write(n);
+	dma_ev_pending_write(1);
+	dma_start_write(1);
+}
+
+int dma_memcpy_start(void *dest, const void *src, size_t n)
+{
+	char *d = dest;
+	const char *s = src;
+	size_t head, body;
+
+	if((n < DMA_MIN_LENGTH) || (((unsigned int)d ^ (unsigned int)s) & (DMA_ALIGN - 1))) {
+		memcpy(dest, src, n);
+		return 0;
+	}
+
+	/* the CPU copies the unaligned ends, the engine the rest */
+	head = -(unsigned int)d & (DMA_ALIGN - 1);
+	body = (n - head) & ~(DMA_ALIGN - 1);
+	memcpy(d, s, head);
+	memcpy(d + head + body, s + head + body, n - head - body);
+
+	flush_cpu_dcache_range((void *)(s + head), body);
+	dma_source_write((unsigned int)(s + head));
+	dma_fill_write(0);
+	dma_start(d + head, body);
+	return 1;
+}
+
+int dma_memset_start(void *dest, int c, size_t n)
+{
+	char *d = dest;
+	size_t head, body;
+
+	if(n < DMA_MIN_LENGTH) {
+		memset(dest, c, n);
+		return 0;
+	}
+
+	head = -(unsigned int)d & (DMA_ALIGN - 1);
+	body = (n - head) & ~(DMA_ALIGN - 1);
+	memset(d, c, head);
+	memset(d + head + body, c, n - head - body);
+
+	dma_value_write(0x0101010101010101ULL*(unsigned char)c);
+	dma_fill_write(1);
+	dma_start(d + head, body);
+	return 1;
+}
+
+int dma_busy(void)
+{
+	return dma_busy_read();
+}
+
+void dma_wait(void)
+{
+	while(dma_busy_read());
+	invalidate_cpu_dcache_range(dma_dest, dma_length);
+}
+
+#else
+
+int dma_memcpy_start(void *dest, const void *src, size_t n)
+{
+	memcpy(dest, src, n);
+	return 0;
+}
+
+int dma_memset_start(void *dest, int c, size_t n)
+{
+	memset(dest, c, n);
+	return 0;
+}
+
+int dma_busy(void)
+{
+	return 0;
+}
+
+void dma_wait(void)
+{
+}
+
+#endif
+
+void *dma_memcpy(void *dest, const void *src, size_t n)
+{
+	if(dma_memcpy_start(dest, src, n))
+		dma_wait();
+	return dest;
+}
+
+void *dma_memset(void *dest, int c, size_t n)
+{
+	if(dma_memset_start(dest, c, n))
+		dma_wait();
+	return dest;
+}
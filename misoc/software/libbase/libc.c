@@ -202,6 +202,15 @@ char *strncat(char *dest, const char *src, size_t count)
   return tmp;
 }
 
+/*
+ * The word functions below read whole aligned words, which never crosses
+ * into memory that holds none of the bytes they look at.
+ */
+#define WORD_ALIGNED(p) (((unsigned long)(p) & 3) == 0)
+#define REPEAT_BYTE(c) (0x01010101U*(unsigned char)(c))
+/* nonzero if one of the bytes of w is zero */
+#define HAS_ZERO_BYTE(w) (((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
 /**
  * strlen - Find the length of a string
  * @s: The string to be sized
@@ -209,8 +218,14 @@ char *strncat(char *dest, const char *src, size_t count)
 size_t strlen(const char *s)
 {
 	const char *sc;
+	const unsigned int *w;
 
-	for (sc = s; *sc != '\0'; ++sc)
+	for (sc = s; !WORD_ALIGNED(sc); ++sc)
+		if (*sc == '\0')
+			return sc - s;
+	for (w = (const unsigned int *)sc; !HAS_ZERO_BYTE(*w); ++w)
+		/* nothing */;
+	for (sc = (const char *)w; *sc != '\0'; ++sc)
 		/* nothing */;
 	return sc - s;
 }
@@ -223,8 +238,14 @@ size_t strlen(const char *s)
 size_t strnlen(const char *s, size_t count)
 {
 	const char *sc;
-
-	for (sc = s; count-- && *sc != '\0'; ++sc)
+	const unsigned int *w;
+
+	for (sc = s; count && !WORD_ALIGNED(sc); ++sc, count--)
+		if (*sc == '\0')
+			return sc - s;
+	for (w = (const unsigned int *)sc; count >= 4 && !HAS_ZERO_BYTE(*w); ++w)
+		count -= 4;
+	for (sc = (const char *)w; count-- && *sc != '\0'; ++sc)
 		/* nothing */;
 	return sc - s;
 }
@@ -261,9 +282,24 @@ size_t strspn(const char *s, const char *accept)
 int memcmp(const void *cs, const void *ct, size_t count)
 {
 	const unsigned char *su1, *su2;
+	const unsigned int *w1, *w2;
 	int res = 0;
 
-	for (su1 = cs, su2 = ct; 0 < count; ++su1, ++su2, count--)
+	su1 = cs;
+	su2 = ct;
+	if (((unsigned long)su1 & 3) == ((unsigned long)su2 & 3)) {
+		for (; count && !WORD_ALIGNED(su1); ++su1, ++su2, count--)
+			if ((res = *su1 - *su2) != 0)
+				return res;
+		/* skip equal words, the first differing one is compared bytewise */
+		w1 = (const unsigned int *)su1;
+		w2 = (const unsigned int *)su2;
+		for (; count >= 4 && *w1 == *w2; ++w1, ++w2)
+			count -= 4;
+		su1 = (const unsigned char *)w1;
+		su2 = (const unsigned char *)w2;
+	}
+	for (; 0 < count; ++su1, ++su2, count--)
 		if ((res = *su1 - *su2) != 0)
 			break;
 	return res;
@@ -278,12 +314,67 @@ int memcmp(const void *cs, const void *ct, size_t count)
 void *memset(void *s, int c, size_t count)
 {
 	char *xs = s;
+	unsigned int *w;
+	unsigned int pattern;
 
+	for (; count && !WORD_ALIGNED(xs); count--)
+		*xs++ = c;
+	pattern = REPEAT_BYTE(c);
+	w = (unsigned int *)xs;
+	for (; count >= 16; count -= 16) {
+		w[0] = pattern;
+		w[1] = pattern;
+		w[2] = pattern;
+		w[3] = pattern;
+		w += 4;
+	}
+	for (; count >= 4; count -= 4)
+		*w++ = pattern;
+	xs = (char *)w;
 	while (count--)
 		*xs++ = c;
 	return s;
 }
 
+/*
+ * Merges the aligned source words a and b, which are in this order in
+ * memory, into the word that starts shift/8 bytes into a.
+ */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define MERGE(a, b, shift) (((a) << (shift)) | ((b) >> (32 - (shift))))
+#else
+#define MERGE(a, b, shift) (((a) >> (shift)) | ((b) << (32 - (shift))))
+#endif
+
+/*
+ * Copies n/4 words to the aligned wd from a source that is shift/8 bytes
+ * past the aligned word ws, reading each source word once.
+ */
+#define COPY_SHIFTED(shift) \
+	do { \
+		unsigned int w0, w1, w2, w3, w4; \
+		w0 = *ws++; \
+		for(; n >= 16; n -= 16) { \
+			w1 = ws[0]; \
+			w2 = ws[1]; \
+			w3 = ws[2]; \
+			w4 = ws[3]; \
+			wd[0] = MERGE(w0, w1, shift); \
+			wd[1] = MERGE(w1, w2, shift); \
+			wd[2] = MERGE(w2, w3, shift); \
+			wd[3] = MERGE(w3, w4, shift); \
+			ws += 4; \
+			wd += 4; \
+			w0 = w4; \
+		} \
+		for(; n >= 4; n -= 4) { \
+			w1 = *ws++; \
+			*wd++ = MERGE(w0, w1, shift); \
+			w0 = w1; \
+		} \
+		ws--; \
+	} while(0)
+
 /**
  * memcpy - Copies one area of memory to another
  * @dest: Destination
@@ -292,71 +383,55 @@ void *memset(void *s, int c, size_t count)
  */
 void *memcpy(void *to, const void *from, size_t n)
 {
-	void *xto = to;
-	size_t temp;
-
-	if(!n)
-		return xto;
-	if((long)to & 1) {
-		char *cto = to;
-		const char *cfrom = from;
+	unsigned char *cto = to;
+	const unsigned char *cfrom = from;
+	unsigned int *wd;
+	const unsigned int *ws;
+	unsigned int offset;
+
+	/* align the destination */
+	for(; n && ((unsigned long)cto & 3); n--)
 		*cto++ = *cfrom++;
-		to = cto;
-		from = cfrom;
-		n--;
-	}
-	if((long)from & 1) {
-		char *cto = to;
-		const char *cfrom = from;
-		for (; n; n--)
-			*cto++ = *cfrom++;
-		return xto;
-	}
-	if(n > 2 && (long)to & 2) {
-		short *sto = to;
-		const short *sfrom = from;
-		*sto++ = *sfrom++;
-		to = sto;
-		from = sfrom;
-		n -= 2;
-	}
-	if((long)from & 2) {
-		short *sto = to;
-		const short *sfrom = from;
-		temp = n >> 1;
-		for (; temp; temp--)
-			*sto++ = *sfrom++;
-		to = sto;
-		from = sfrom;
-		if(n & 1) {
-			char *cto = to;
-			const char *cfrom = from;
-			*cto = *cfrom;
+
+	if(n >= 4) {
+		offset = (unsigned long)cfrom & 3;
+		wd = (unsigned int *)cto;
+		ws = (const unsigned int *)(cfrom - offset);
+		switch(offset) {
+			case 0:
+				/* eight words, one cache line on most of our CPUs */
+				for(; n >= 32; n -= 32) {
+					wd[0] = ws[0];
+					wd[1] = ws[1];
+					wd[2] = ws[2];
+					wd[3] = ws[3];
+					wd[4] = ws[4];
+					wd[5] = ws[5];
+					wd[6] = ws[6];
+					wd[7] = ws[7];
+					ws += 8;
+					wd += 8;
+				}
+				for(; n >= 4; n -= 4)
+					*wd++ = *ws++;
+				break;
+			case 1:
+				COPY_SHIFTED(8);
+				break;
+			case 2:
+				COPY_SHIFTED(16);
+				break;
+			default:
+				COPY_SHIFTED(24);
+				break;
 		}
-		return xto;
-	}
-	temp = n >> 2;
-	if(temp) {
-		long *lto = to;
-		const long *lfrom = from;
-		for(; temp; temp--)
-			*lto++ = *lfrom++;
-		to = lto;
-		from = lfrom;
-	}
-	if(n & 2) {
-		short *sto = to;
-		const short *sfrom = from;
-		*sto++ = *sfrom++;
-		to = sto;
-		from = sfrom;
+		cto = (unsigned char *)wd;
+		cfrom = (const unsigned char *)ws + offset;
 	}
-	if(n & 1) {
-		char *cto = to;
-		const char *cfrom = from;
-		*cto = *cfrom;
-	}
-	return xto;
+
+	for(; n; n--)
+		*cto++ = *cfrom++;
+	return to;
 }
 
 /**
@@ -418,8 +493,21 @@ char *strstr(const char *s1, const char *s2)
 void *memchr(const void *s, int c, size_t n)
 {
 	const unsigned char *p = s;
+	const unsigned int *w;
+	unsigned int pattern;
+
+	for (; n && !WORD_ALIGNED(p); n--) {
+		if ((unsigned char)c == *p++) {
+			return (void *)(p - 1);
+		}
+	}
+	/* a byte equal to c is a zero byte once xored with the pattern */
+	pattern = REPEAT_BYTE(c);
+	for (w = (const unsigned int *)p; n >= 4 && !HAS_ZERO_BYTE(*w ^ pattern); ++w)
+		n -= 4;
+	p = (const unsigned char *)w;
 	while (n-- != 0) {
-        	if ((unsigned char)c == *p++) {
+		if ((unsigned char)c == *p++) {
 			return (void *)(p - 1);
 		}
 	}
@@ -0,0 +1,74 @@
+#include <string.h>
+#include <lz4.h>
+
+/*
+ * Decompresses a raw LZ4 block (as written by mkmscimg) in a single
+ * forward pass. Returns the number of bytes written to dst, or -1 if the
+ * input is malformed or does not fit into dst_len bytes.
+ */
+int lz4_decompress(const unsigned char *src, unsigned int src_len,
+	unsigned char *dst, unsigned int dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char *iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char *oend = dst + dst_len;
+	const unsigned char *match;
+	unsigned int token, length, offset;
+	unsigned char c;
+
+	while(ip < iend) {
+		token = *ip++;
+
+		/* literals */
+		length = token >> 4;
+		if(length == 15) {
+			do {
+				if(ip >= iend)
+					return -1;
+				c = *ip++;
+				length += c;
+			} while(c == 255);
+		}
+		if((length > (unsigned int)(iend - ip)) || (length > (unsigned int)(oend - op)))
+			return -1;
+		memcpy(op, ip, length);
+		op += length;
+		ip += length;
+
+		/* the last sequence has no match part */
+		if(ip == iend)
+			break;
+
+		/* match */
+		if(iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if((offset == 0) || (offset > (unsigned int)(op - dst)))
+			return -1;
+		match = op - offset;
+
+		length = token & 0x0f;
+		if(length == 15) {
+			do {
+				if(ip >= iend)
+					return -1;
+				c = *ip++;
+				length += c;
+			} while(c == 255);
+		}
+		length += 4;
+		if(length > (unsigned int)(oend - op))
+			return -1;
+		if(offset >= length) {
+			memcpy(op, match, length);
+			op += length;
+		} else {
+			/* overlapping match, replicates the last offset bytes */
+			while(length--)
+				*op++ = *match++;
+		}
+	}
+	return op - dst;
+}
@@ -82,7 +82,61 @@ void flush_cpu_dcache(void)
 #endif
 }
 
+#if defined (__or1k__)
+static void dcache_block_op(unsigned long spr, void *addr, unsigned int len)
+{
+	unsigned long cache_block_size;
+	unsigned long a, end;
+
+	if(len == 0)
+		return;
+	cache_block_size = (mfspr(SPR_DCCFGR) & SPR_DCCFGR_CBS) ? 32 : 16;
+	end = (unsigned long)addr + len;
+	for(a = (unsigned long)addr & ~(cache_block_size - 1); a < end; a += cache_block_size)
+		mtspr(spr, a);
+}
+#endif
+
+void flush_cpu_dcache_range(void *addr, unsigned int len)
+{
+#if defined (__or1k__)
+	dcache_block_op(SPR_DCBFR, addr, len);
+#elif defined (__lm32__) || defined (__vexriscv__)
+	/* write-through data cache, memory is always up to date */
+#else
+#error Unsupported architecture
+#endif
+}
+
+void invalidate_cpu_dcache_range(void *addr, unsigned int len)
+{
+#if defined (__or1k__)
+	dcache_block_op(SPR_DCBIR, addr, len);
+#elif defined (__lm32__) || defined (__vexriscv__)
+	/* no per-line invalidation on these CPUs */
+	flush_cpu_dcache();
+#else
+#error Unsupported architecture
+#endif
+}
+
 #ifdef CONFIG_L2_SIZE
+#ifdef CSR_L2_CACHE_BASE
+/* writes back the dirty lines and invalidates the cache */
+void flush_l2_cache(void)
+{
+	l2_cache_flush_write(1);
+	while(l2_cache_busy_read());
+}
+
+void writeback_l2_cache_range(void *addr, unsigned int len)
+{
+	l2_cache_writeback_base_write((unsigned int)addr);
+	l2_cache_writeback_length_write(len);
+	l2_cache_writeback_write(1);
+	while(l2_cache_busy_read());
+}
+#else
 void flush_l2_cache(void)
 {
 	unsigned int i;
@@ -90,4 +144,10 @@ void flush_l2_cache(void)
 		((volatile unsigned int *) MAIN_RAM_BASE)[i];
 	}
 }
+
+void writeback_l2_cache_range(void *addr, unsigned int len)
+{
+	flush_l2_cache();
+}
+#endif
 #endif
@@ -352,7 +352,7 @@ void microudp_set_callback(udp_callback callback)
 
 static void process_frame(void)
 {
-	flush_cpu_dcache();
+	invalidate_cpu_dcache_range(rxbuffer, rxlen);
 
 #ifndef HW_PREAMBLE_CRC
 	int i;
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <limits.h>
 #include <string.h>
 
 #include <net/microudp.h>
@@ -59,6 +60,7 @@ static uint8_t *packet_data;
 static int total_length;
 static int transfer_finished;
 static uint8_t *dst_buffer;
+static int dst_size;
 static int last_ack; /* signed, so we can use -1 */
 static uint16_t data_port;
 
@@ -84,6 +86,12 @@ static void rx_callback(uint32_t src_ip, uint16_t src_port,
 	if(opcode == TFTP_DATA) { /* Data */
 		length -= 4;
 		offset = (block-1)*BLOCK_SIZE;
+		if(offset + length > dst_size) {
+			/* the file does not fit, drop the transfer */
+			total_length = -1;
+			transfer_finished = 1;
+			return;
+		}
 		for(i=0;i<length;i++)
 			dst_buffer[offset+i] = data[i+4];
 		total_length += length;
@@ -101,6 +109,11 @@ static void rx_callback(uint32_t src_ip, uint16_t src_port,
 }
 
 int tftp_get(uint32_t ip, const char *filename, void *buffer)
+{
+	return tftp_get_max(ip, filename, buffer, INT_MAX);
+}
+
+int tftp_get_max(uint32_t ip, const char *filename, void *buffer, int size)
 {
 	int len;
 	int tries;
@@ -113,6 +126,7 @@ int tftp_get(uint32_t ip, const char *filename, void *buffer)
 	microudp_set_callback(rx_callback);
 
 	dst_buffer = buffer;
+	dst_size = size;
 
 	total_length = 0;
 	transfer_finished = 0;
@@ -177,7 +177,7 @@ class MiniSoC(BaseSoC):
 
 
 def soc_afc3v1_args(parser):
-    soc_sdram_args(parser)
+    soc_sdram_args(parser, with_sdram_controller=True)
     parser.add_argument("--with-spi-flash", action="store_false",
                         help="enable SPI Flash support ")
 
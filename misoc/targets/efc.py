@@ -195,7 +195,7 @@ class BaseSoC(SoCSDRAM):
 def main():
     parser = argparse.ArgumentParser(description="MiSoC port to Sinara EEM FMC Carrier")
     builder_args(parser)
-    soc_sdram_args(parser)
+    soc_sdram_args(parser, with_sdram_controller=True)
     args = parser.parse_args()
 
     soc = BaseSoC(**soc_sdram_argdict(args))
@@ -466,7 +466,7 @@ class MiniSoC(BaseSoC):
 
 
 def soc_kasli_args(parser):
-    soc_sdram_args(parser)
+    soc_sdram_args(parser, with_sdram_controller=True)
     parser.add_argument("--hw-rev", default=None,
                         help="Kasli hardware revision: v1.0/v1.1/v2.0 "
                              "(default: variant-dependent)")
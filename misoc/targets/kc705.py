@@ -319,7 +319,7 @@ class MiniSoC(BaseSoC):
             self.ethphy.crg.cd_eth_tx.clk, eth_clocks.rx)
 
 def soc_kc705_args(parser):
-    soc_sdram_args(parser)
+    soc_sdram_args(parser, with_sdram_controller=True)
     parser.add_argument("--toolchain", default="vivado",
                         help="FPGA toolchain to use: ise, vivado")
 
@@ -93,7 +93,7 @@ class MiniSoC(BaseSoC):
 def main():
     parser = argparse.ArgumentParser(description="MiSoC port to the Metlino")
     builder_args(parser)
-    soc_sdram_args(parser)
+    soc_sdram_args(parser, with_sdram_controller=True)
     parser.add_argument("--with-ethernet", action="store_true",
                         help="enable Ethernet support")
     args = parser.parse_args()
@@ -175,7 +175,7 @@ class MiniSoC(BaseSoC):
 
 
 def soc_sayma_amc_args(parser):
-    soc_sdram_args(parser)
+    soc_sdram_args(parser, with_sdram_controller=True)
     parser.add_argument("--hw-rev", default=None,
                         help="Sayma AMC hardware revision: v1.0/v2.0")
 
@@ -0,0 +1,145 @@
+import unittest
+
+from migen import *
+
+from misoc.interconnect import wishbone
+
+
+def _initial(adr):
+    return (adr*0x9e3779b1 + 0x12345) & 0xffffffff
+
+
+class _SlaveMemory:
+    def __init__(self, bus, ratio):
+        self.bus = bus
+        self.ratio = ratio
+        self.mem = dict()
+        self.reads = 0
+        self.writes = 0
+
+    def word(self, adr):
+        """Returns the master word at ``adr``, as seen by the slave. The
+        first word of a line is in its most significant bits."""
+        line = self.mem.get(adr//self.ratio)
+        if line is None:
+            return _initial(adr)
+        return (line >> 32*(self.ratio - 1 - adr % self.ratio)) & 0xffffffff
+
+    @passive
+    def gen(self):
+        bus = self.bus
+        while True:
+            if (yield bus.cyc) and (yield bus.stb):
+                adr = yield bus.adr
+                if (yield bus.we):
+                    self.mem[adr] = yield bus.dat_w
+                    self.writes += 1
+                else:
+                    dat = 0
+                    for i in range(self.ratio):
+                        dat |= self.word(adr*self.ratio + i) << 32*(self.ratio - 1 - i)
+                    yield bus.dat_r.eq(dat)
+                    self.reads += 1
+                yield bus.ack.eq(1)
+                yield
+                yield bus.ack.eq(0)
+            yield
+
+
+def _trace(length):
+    """Accesses of a small loop: instructions, a stack frame and a streamed
+    buffer, placed at addresses that alias in a direct-mapped cache"""
+    code = 0x10000
+    stack = 0x20000 + 0x4
+    buffer = 0x30000 + 0x20
+    r = []
+    for i in range(length):
+        r.append((code + i % 16, None))
+        r.append((stack + i % 8, None if i % 3 else i))
+        r.append((buffer + i, None))
+        r.append((code + (i + 5) % 16, None))
+        r.append((stack + (i + 1) % 8, i*7))
+    return r
+
+
+class TestCache(unittest.TestCase):
+    def run_trace(self, trace, ways=1, pipelined=False, cachesize=256):
+        master = wishbone.Interface()
+        slave = wishbone.Interface(128, 28)
+        dut = wishbone.Cache(cachesize, master, slave,
+                             pipelined=pipelined, ways=ways)
+        memory = _SlaveMemory(slave, 4)
+        reference = dict()
+
+        def check(adr, dat):
+            self.assertEqual(dat, reference.get(adr, _initial(adr)),
+                             "address {:#x}".format(adr))
+
+        def master_gen():
+            for adr, dat in trace:
+                if dat is None:
+                    check(adr, (yield from master.read(adr)))
+                else:
+                    yield from master.write(adr, dat)
+                    reference[adr] = dat
+
+            # flush and compare the slave memory with the reference
+            yield dut._flush.re.eq(1)
+            yield
+            yield dut._flush.re.eq(0)
+            yield
+            while (yield dut._busy.status):
+                yield
+            for adr, dat in reference.items():
+                self.assertEqual(memory.word(adr), dat,
+                                 "address {:#x}".format(adr))
+
+        run_simulation(dut, [master_gen(), memory.gen()])
+        return memory
+
+    def test_direct_mapped(self):
+        self.run_trace(_trace(64))
+
+    def test_set_associative(self):
+        for ways in 2, 4:
+            self.run_trace(_trace(64), ways=ways)
+
+    def test_pipelined(self):
+        self.run_trace(_trace(64), ways=4, pipelined=True)
+
+    def test_hit_rate(self):
+        trace = _trace(128)
+        direct = self.run_trace(trace)
+        associative = self.run_trace(trace, ways=4)
+        # the buffer misses in both, the code and stack only in the
+        # direct-mapped cache
+        self.assertLess(associative.reads, direct.reads//2)
+        self.assertLess(associative.writes, direct.writes)
+
+    def test_write_back_buffer(self):
+        # dirty lines evicted by an aliasing refill and read back before
+        # the write-back buffer could drain
+        trace = [(0x100, 0x1234), (0x200, None), (0x100, None),
+                 (0x201, 0x5678), (0x101, None), (0x201, None)]
+        for ways in 1, 2:
+            self.run_trace(trace, ways=ways)
+
+    def test_invalidate(self):
+        master = wishbone.Interface()
+        slave = wishbone.Interface(128, 28)
+        dut = wishbone.Cache(256, master, slave, ways=2)
+        memory = _SlaveMemory(slave, 4)
+
+        def master_gen():
+            yield from master.write(0x100, 0xdeadbeef)
+            yield
+            yield dut._invalidate.re.eq(1)
+            yield
+            yield dut._invalidate.re.eq(0)
+            yield
+            while (yield dut._busy.status):
+                yield
+            self.assertEqual((yield from master.read(0x100)), _initial(0x100))
+            self.assertEqual(memory.writes, 0)
+
+        run_simulation(dut, [master_gen(), memory.gen()])
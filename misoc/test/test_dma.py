@@ -0,0 +1,106 @@
+import unittest
+
+from migen import *
+
+from misoc.cores.dma import DMA
+from misoc.interconnect import wishbone
+
+
+class _DMASRAM(Module):
+    def __init__(self, init):
+        self.submodules.dma = DMA()
+        self.submodules.sram = wishbone.SRAM(4*len(init), init=init)
+        self.master = wishbone.Interface()
+        self.submodules.arbiter = wishbone.Arbiter([self.dma.bus, self.master],
+                                                   self.sram.bus)
+
+
+def _transfer(dut, source=0, destination=0, length=0, fill=None):
+    """Starts a copy or, with ``fill`` set to the value, a fill, and
+    waits for its done event"""
+    yield dut.dma._source.storage.eq(4*source)
+    yield dut.dma._destination.storage.eq(4*destination)
+    yield dut.dma._length.storage.eq(4*length)
+    yield dut.dma._fill.storage.eq(fill is not None)
+    yield dut.dma._value.storage.eq(fill or 0)
+    yield dut.dma._start.re.eq(1)
+    yield
+    yield dut.dma._start.re.eq(0)
+    while not (yield dut.dma.ev.done.trigger):
+        yield
+    yield
+
+
+class TestDMA(unittest.TestCase):
+    def _test_transfer(self, init, expected, chunks, **kwargs):
+        dut = _DMASRAM(init)
+        beats = []
+
+        @passive
+        def monitor():
+            cycle = 0
+            bus = dut.dma.bus
+            while True:
+                if (yield bus.cyc) and (yield bus.stb) and (yield bus.ack):
+                    beats.append((cycle, (yield bus.we), (yield bus.adr),
+                                  (yield bus.cti), (yield bus.bte)))
+                cycle += 1
+                yield
+
+        def gen():
+            yield from _transfer(dut, **kwargs)
+            for i in range(len(init)):
+                self.assertEqual((yield dut.sram.mem[i]), expected[i], "word {}".format(i))
+
+        run_simulation(dut, [gen(), monitor()])
+
+        # chunks are linear incrementing bursts, acked in consecutive
+        # cycles by the SRAM
+        bursts = [[]]
+        for beat in beats:
+            bursts[-1].append(beat)
+            if beat[3] == 0b111:
+                bursts.append([])
+        self.assertEqual(bursts.pop(), [])
+        self.assertEqual([(len(b), b[0][1], b[0][2]) for b in bursts], chunks)
+        for burst in bursts:
+            cycle, we, adr, cti, bte = burst[0]
+            self.assertEqual(burst, [(cycle + i, we, adr + i, 0b010, 0b00)
+                                     for i in range(len(burst) - 1)] + [burst[-1]])
+            self.assertEqual(burst[-1][:3], (cycle + len(burst) - 1, we, adr + len(burst) - 1))
+
+    def test_copy(self):
+        init = [0x1000 + i for i in range(64)]
+        expected = init[:40] + init[3:24] + init[61:]
+        self._test_transfer(init, expected,
+                            [(8, 0, 3), (8, 1, 40), (8, 0, 11), (8, 1, 48),
+                             (5, 0, 19), (5, 1, 56)],
+                            source=3, destination=40, length=21)
+
+    def test_fill(self):
+        init = [0x1000 + i for i in range(64)]
+        expected = init[:5] + [0xcafe]*19 + init[24:]
+        self._test_transfer(init, expected,
+                            [(8, 1, 5), (8, 1, 13), (3, 1, 21)],
+                            destination=5, length=19, fill=0xcafe)
+
+    def test_shared_bus(self):
+        # a classic master gets the bus between the bursts of a copy
+        init = [0x1000 + i for i in range(64)]
+        dut = _DMASRAM(init)
+        reads = []
+
+        def classic_master():
+            for i in range(8):
+                yield
+            while (yield dut.dma._busy.status):
+                self.assertEqual((yield from dut.master.read(63)), init[63])
+                reads.append((yield dut.dma._busy.status))
+
+        def gen():
+            yield from _transfer(dut, source=0, destination=32, length=24)
+            for i in range(24):
+                self.assertEqual((yield dut.sram.mem[32 + i]), init[i])
+
+        run_simulation(dut, [gen(), classic_master()])
+        self.assertGreater(reads.count(1), 2)
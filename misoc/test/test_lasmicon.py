@@ -0,0 +1,141 @@
+import unittest
+import random
+
+from migen import *
+
+from misoc.cores.sdram_settings import PhySettings, GeomSettingsT, TimingSettings
+from misoc.cores.sdram_model import SDRAMPHYSim, DFITimingChecker
+from misoc.cores.lasmicon import LASMIcon, LASMIconSettings
+from misoc.interconnect import lasmi_bus
+
+
+_phy_settings = PhySettings(memtype="SDR", dfi_databits=16, nphases=1,
+                            rdphase=0, wrphase=0, rdcmdphase=0, wrcmdphase=0,
+                            cl=2, read_latency=4, write_latency=0)
+_timing_settings = TimingSettings(tRP=2, tRCD=2, tWR=2, tWTR=2,
+                                  tREFI=100000, tRFC=6)
+
+
+class _Module:
+    # 4 banks of 256 rows of 64 words, with A10 for PRECHARGE ALL
+    geom_settings = GeomSettingsT(bankbits=2, rowbits=8, colbits=6, addressbits=11)
+
+
+class _LASMIconSim(Module):
+    def __init__(self, nmasters, timing_settings=_timing_settings,
+                 controller_settings=LASMIconSettings()):
+        self.submodules.phy = SDRAMPHYSim(_Module, _phy_settings)
+        self.submodules.controller = LASMIcon(
+            _phy_settings, _Module.geom_settings, timing_settings,
+            controller_settings)
+        self.comb += self.controller.dfi.connect(self.phy.dfi)
+        # row, bank, column
+        self.submodules.crossbar = lasmi_bus.LASMIxbar(
+            [self.controller.lasmic], self.controller.nrowbits)
+        self.masters = [self.crossbar.get_master() for i in range(nmasters)]
+        # the crossbar ORs the write data of its masters: it is only driven
+        # when acked
+        self.dat_w = [Signal(len(master.dat_w)) for master in self.masters]
+        for master, dat_w in zip(self.masters, self.dat_w):
+            self.comb += If(master.dat_w_ack,
+                master.dat_w.eq(dat_w),
+                master.dat_we.eq(2**len(master.dat_we) - 1)
+            )
+        self.checker = DFITimingChecker(self.phy.dfi, _phy_settings, timing_settings)
+
+
+def _master(lasmim, dat_w, requests, results):
+    """Issues the (address, data) requests back to back, data is None for
+    reads, and appends the data of the reads to results. Data is acked in
+    request order."""
+    requests = list(requests)
+    writes = []
+    reads = 0
+    while requests or writes or reads:
+        if requests:
+            adr, dat = requests[0]
+            yield lasmim.stb.eq(1)
+            yield lasmim.adr.eq(adr)
+            yield lasmim.we.eq(dat is not None)
+        else:
+            yield lasmim.stb.eq(0)
+        # the data of the oldest write is presented until it is acked
+        if writes:
+            yield dat_w.eq(writes[0])
+        yield
+        if (yield lasmim.dat_w_ack):
+            writes.pop(0)
+        if (yield lasmim.dat_r_ack):
+            results.append((yield lasmim.dat_r))
+            reads -= 1
+        if requests and (yield lasmim.req_ack):
+            adr, dat = requests.pop(0)
+            if dat is None:
+                reads += 1
+            else:
+                writes.append(dat)
+    yield lasmim.stb.eq(0)
+
+
+def _traffic(prng, cols, n, model):
+    """Random writes to a few rows of each bank and reads of the written
+    addresses, returns the requests and the data expected from the reads"""
+    geom_settings = _Module.geom_settings
+    requests = []
+    expected = []
+    written = []
+    for i in range(n):
+        if written and prng.randrange(2):
+            adr = prng.choice(written)
+            requests.append((adr, None))
+            expected.append(model[adr])
+        else:
+            row = prng.randrange(3)
+            bank = prng.randrange(2**geom_settings.bankbits)
+            col = prng.choice(cols)
+            adr = (((row << geom_settings.bankbits) | bank) << geom_settings.colbits) | col
+            dat = prng.randrange(2**16)
+            model[adr] = dat
+            written.append(adr)
+            requests.append((adr, dat))
+    return requests, expected
+
+
+class TestLASMIcon(unittest.TestCase):
+    def _test_traffic(self, nmasters, n, **kwargs):
+        prng = random.Random(nmasters)
+        dut = _LASMIconSim(nmasters, **kwargs)
+        # each master has its own columns in the rows they share
+        ncols = 2**_Module.geom_settings.colbits
+        cols = [range(i, ncols, nmasters) for i in range(nmasters)]
+        model = {}
+        traffic = [_traffic(prng, cols[i], n, model) for i in range(nmasters)]
+        results = [[] for i in range(nmasters)]
+        generators = [_master(master, dat_w, requests, result)
+                      for master, dat_w, (requests, expected), result
+                      in zip(dut.masters, dut.dat_w, traffic, results)]
+        run_simulation(dut, generators + [dut.checker.run()])
+        for (requests, expected), result in zip(traffic, results):
+            self.assertEqual(result, expected)
+        return dut.checker.commands
+
+    def test_mixed_traffic(self):
+        commands = self._test_traffic(1, 400)
+        # the traffic takes turns, hits and misses in all banks
+        names = [c[2] for c in commands]
+        for name in "ACTIVATE", "PRECHARGE", "READ", "WRITE":
+            self.assertGreater(names.count(name), 10)
+        self.assertEqual({c[3] for c in commands}, {0, 1, 2, 3})
+
+    def test_concurrent_masters(self):
+        self._test_traffic(3, 200)
+
+    def test_refresh(self):
+        timing_settings = _timing_settings._replace(tREFI=40)
+        commands = self._test_traffic(2, 200, timing_settings=timing_settings)
+        self.assertGreater([c[2] for c in commands].count("REFRESH"), 10)
+
+    def test_direction_timeouts(self):
+        # short read and write times make the multiplexer turn around often
+        self._test_traffic(2, 200,
+                           controller_settings=LASMIconSettings(read_time=2, write_time=2))
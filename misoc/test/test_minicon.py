@@ -0,0 +1,282 @@
+import unittest
+
+from migen import *
+
+from misoc.cores.sdram_settings import PhySettings, GeomSettingsT, TimingSettings
+from misoc.cores.sdram_model import SDRAMPHYSim, DFITimingChecker
+from misoc.cores.minicon import Minicon
+
+
+_phy_settings = PhySettings(memtype="SDR", dfi_databits=16, nphases=1,
+                            rdphase=0, wrphase=0, rdcmdphase=0, wrcmdphase=0,
+                            cl=2, read_latency=4, write_latency=0)
+_timing_settings = TimingSettings(tRP=2, tRCD=2, tWR=2, tWTR=2,
+                                  tREFI=100000, tRFC=6)
+
+
+class _Module:
+    # 4 banks of 256 rows of 64 words, with A10 for PRECHARGE ALL
+    geom_settings = GeomSettingsT(bankbits=2, rowbits=8, colbits=6, addressbits=11)
+
+
+class _MiniconSim(Module):
+    def __init__(self, mapping="RBC", timing_settings=_timing_settings):
+        geom_settings = _Module.geom_settings
+        self.submodules.phy = SDRAMPHYSim(_Module, _phy_settings)
+        self.submodules.controller = Minicon(
+            _phy_settings, geom_settings, timing_settings,
+            adr_width=geom_settings.bankbits + geom_settings.rowbits + geom_settings.colbits,
+            address_mapping=mapping)
+        self.comb += self.controller.dfi.connect(self.phy.dfi)
+        self.bus = self.controller.bus
+        self.checker = DFITimingChecker(self.phy.dfi, _phy_settings, timing_settings)
+
+
+def _stream_write(bus, writes):
+    """Writes the (address, data) pairs with stb held, one per cycle if
+    the slave acks them"""
+    writes = list(writes)
+    yield bus.we.eq(1)
+    yield bus.sel.eq(2**len(bus.sel) - 1)
+    yield bus.cyc.eq(1)
+    yield bus.stb.eq(1)
+    while writes:
+        adr, dat = writes[0]
+        yield bus.adr.eq(adr)
+        yield bus.dat_w.eq(dat)
+        yield
+        while not (yield bus.ack):
+            yield
+        writes.pop(0)
+    yield bus.cyc.eq(0)
+    yield bus.stb.eq(0)
+    yield bus.we.eq(0)
+
+
+def _burst_read(bus, adr, n, end=True):
+    """Reads n words from adr with an incrementing burst, which is
+    abandoned without an end-of-burst cycle unless ``end`` is set"""
+    data = []
+    yield bus.we.eq(0)
+    yield bus.cyc.eq(1)
+    yield bus.stb.eq(1)
+    for i in range(n):
+        yield bus.adr.eq(adr + i)
+        yield bus.cti.eq(0b111 if end and i == n - 1 else 0b010)
+        yield
+        while not (yield bus.ack):
+            yield
+        data.append((yield bus.dat_r))
+    yield bus.cyc.eq(0)
+    yield bus.stb.eq(0)
+    yield bus.cti.eq(0)
+    return data
+
+
+def _patterns():
+    """Bus traffic as lists of (address, data), data is None for reads"""
+    row = 2**_Module.geom_settings.colbits
+    stripe = row*2**_Module.geom_settings.bankbits
+    size = stripe*2**_Module.geom_settings.rowbits
+    return {
+        # DMA stream
+        "sequential": [(i, None) for i in range(256)],
+        # a[i] = b[i] with arrays of power-of-two size placed back to back
+        "strided": sum([[(stripe + i, None), (i, i)] for i in range(128)], []),
+        # copy from the lower to the upper half of the memory
+        "copy": sum([[(i, None), (size//2 + i, i)] for i in range(128)], [])
+    }
+
+
+def row_hit_rate(mapping, trace):
+    """Runs ``trace`` on Minicon with the given address mapping and returns
+    the fraction of bus accesses that did not need an ACTIVATE"""
+    dut = _MiniconSim(mapping)
+    activates = 0
+
+    @passive
+    def monitor():
+        nonlocal activates
+        phase = dut.phy.dfi.p0
+        while True:
+            if (not (yield phase.cs_n) and not (yield phase.ras_n)
+                    and (yield phase.cas_n) and (yield phase.we_n)):
+                activates += 1
+            yield
+
+    def master():
+        for adr, dat in trace:
+            if dat is None:
+                yield from dut.bus.read(adr)
+            else:
+                yield from dut.bus.write(adr, dat)
+
+    run_simulation(dut, [master(), monitor()])
+    return 1 - activates/len(trace)
+
+
+class TestMinicon(unittest.TestCase):
+    def test_address_mapping(self):
+        row = 2**_Module.geom_settings.colbits
+        stripe = row*2**_Module.geom_settings.bankbits
+        # addresses that differ in the column, bank and row fields
+        addresses = [0, 1, row, row + 1, stripe, stripe + row, 5*stripe + 3*row,
+                     2**15, 2**15 + stripe, 2**16 - 1]
+        for mapping in "RBC", "BRC", "XOR":
+            dut = _MiniconSim(mapping)
+
+            def master():
+                for i, adr in enumerate(addresses):
+                    yield from dut.bus.write(adr, 0x1000 + i)
+                for i, adr in enumerate(addresses):
+                    self.assertEqual((yield from dut.bus.read(adr)), 0x1000 + i,
+                                     "{} address {:#x}".format(mapping, adr))
+
+            run_simulation(dut, [master(), dut.checker.run()])
+
+    def test_row_hit_rate(self):
+        patterns = _patterns()
+        rates = {(mapping, name): row_hit_rate(mapping, trace)
+                 for mapping in ("RBC", "BRC", "XOR")
+                 for name, trace in patterns.items()}
+        for mapping in "RBC", "BRC", "XOR":
+            self.assertGreater(rates[(mapping, "sequential")], 0.9)
+        # arrays a power-of-two stride apart only use different banks
+        # once the row is hashed into the bank
+        self.assertGreater(rates[("XOR", "strided")], rates[("RBC", "strided")])
+        # distant regions use different banks with the bank bits on top
+        self.assertGreater(rates[("BRC", "copy")], rates[("RBC", "copy")])
+
+    def test_back_to_back_writes(self):
+        row = 2**_Module.geom_settings.colbits
+        stripe = row*2**_Module.geom_settings.bankbits
+        dut = _MiniconSim()
+        # row hits, then the next row of the same bank, right after a write
+        writes = [(16 + i, 0x100 + i) for i in range(32)]
+        writes += [(stripe + i, 0x200 + i) for i in range(8)]
+
+        def master():
+            yield from _stream_write(dut.bus, writes)
+            for adr, dat in writes:
+                self.assertEqual((yield from dut.bus.read(adr)), dat)
+
+        run_simulation(dut, [master(), dut.checker.run()])
+        cycles = [c[0] for c in dut.checker.commands if c[2] == "WRITE"]
+        self.assertEqual(cycles[:32], list(range(cycles[0], cycles[0] + 32)))
+        self.assertEqual(cycles[32:], list(range(cycles[32], cycles[32] + 8)))
+
+    def test_abandoned_read_stream(self):
+        row = 2**_Module.geom_settings.colbits
+        stripe = row*2**_Module.geom_settings.bankbits
+        dut = _MiniconSim()
+        mem = {adr: 0x1000 + adr for adr in list(range(64)) + list(range(stripe, stripe + 8))}
+
+        def master():
+            yield from _stream_write(dut.bus, mem.items())
+            # stream abandoned with reads ahead in flight, followed by a read
+            # elsewhere in the row, one where the stream stopped, a write and
+            # a read in another row of the bank
+            self.assertEqual((yield from _burst_read(dut.bus, 4, 3, end=False)),
+                             [mem[4], mem[5], mem[6]])
+            self.assertEqual((yield from dut.bus.read(40)), mem[40])
+            self.assertEqual((yield from _burst_read(dut.bus, 7, 4, end=False)),
+                             [mem[7], mem[8], mem[9], mem[10]])
+            yield from dut.bus.write(11, 0xbeef)
+            mem[11] = 0xbeef
+            self.assertEqual((yield from _burst_read(dut.bus, 9, 4, end=False)),
+                             [mem[9], mem[10], mem[11], mem[12]])
+            self.assertEqual((yield from _burst_read(dut.bus, stripe, 8)),
+                             [mem[stripe + i] for i in range(8)])
+            self.assertEqual((yield from _burst_read(dut.bus, 0, 64)),
+                             [mem[i] for i in range(64)])
+
+        run_simulation(dut, [master(), dut.checker.run()])
+
+    def test_write_between_reads(self):
+        dut = _MiniconSim()
+
+        def master():
+            yield from _stream_write(dut.bus, [(i, 0x1000 + i) for i in range(16)])
+            # addresses read ahead by a burst and by single reads
+            self.assertEqual((yield from _burst_read(dut.bus, 0, 2)), [0x1000, 0x1001])
+            yield from dut.bus.write(2, 0x2002)
+            self.assertEqual((yield from _burst_read(dut.bus, 2, 2)), [0x2002, 0x1003])
+            self.assertEqual((yield from dut.bus.read(4)), 0x1004)
+            yield from dut.bus.write(5, 0x2005)
+            self.assertEqual((yield from dut.bus.read(5)), 0x2005)
+            self.assertEqual((yield from dut.bus.read(6)), 0x1006)
+            yield from _stream_write(dut.bus, [(7, 0x2007), (8, 0x2008)])
+            self.assertEqual((yield from _burst_read(dut.bus, 6, 4)),
+                             [0x1006, 0x2007, 0x2008, 0x1009])
+
+        run_simulation(dut, [master(), dut.checker.run()])
+
+    def test_refresh(self):
+        tREFI = 50
+        dut = _MiniconSim(timing_settings=_timing_settings._replace(tREFI=tREFI))
+        busy = True
+        cycles = 0
+        refreshes = {True: 0, False: 0}
+
+        @passive
+        def monitor():
+            nonlocal cycles
+            phase = dut.phy.dfi.p0
+            while True:
+                if (not (yield phase.cs_n) and not (yield phase.ras_n)
+                        and not (yield phase.cas_n) and (yield phase.we_n)):
+                    refreshes[busy] += 1
+                cycles += 1
+                yield
+
+        def master():
+            nonlocal busy
+            # traffic for less than 8 refresh intervals: all refreshes are
+            # postponed
+            i = 0
+            while cycles < 6*tREFI:
+                yield from dut.bus.read(i % 64)
+                i += 1
+            self.assertEqual(refreshes[True], 0)
+            busy = False
+            # idle: the postponed refreshes are done, then pulled in
+            for i in range(4*tREFI):
+                yield
+            self.assertGreaterEqual(refreshes[False], cycles//tREFI + 1)
+            # at most 8 ahead of the refresh timer
+            self.assertLessEqual(refreshes[False], cycles//tREFI + 1 + 8)
+
+        run_simulation(dut, [master(), monitor(), dut.checker.run()])
+
+    def test_refresh_overload(self):
+        # refreshes take longer than tREFI: the controller falls behind for
+        # good and must keep refreshing back to back, the count of owed
+        # refreshes must not wrap around
+        tREFI = 6
+        timing_settings = _timing_settings._replace(tREFI=tREFI)
+        # PRECHARGE ALL, tRP, REFRESH, tRFC and back to IDLE
+        refresh_cycle = timing_settings.tRP + timing_settings.tRFC + 1
+        self.assertLess(tREFI, refresh_cycle)
+        dut = _MiniconSim(timing_settings=timing_settings)
+        refreshes = []
+
+        def monitor():
+            phase = dut.phy.dfi.p0
+            for cycle in range(100*tREFI):
+                if (not (yield phase.cs_n) and not (yield phase.ras_n)
+                        and not (yield phase.cas_n) and (yield phase.we_n)):
+                    refreshes.append(cycle)
+                yield
+
+        run_simulation(dut, [monitor(), dut.checker.run()])
+        gaps = [b - a for a, b in zip(refreshes, refreshes[1:])]
+        self.assertEqual(max(gaps), refresh_cycle)
+
+
+if __name__ == "__main__":
+    # benchmark: row-hit rate of each mapping for each traffic pattern
+    patterns = _patterns()
+    print("{:12}".format("") + "".join("{:>8}".format(m) for m in ("RBC", "BRC", "XOR")))
+    for name, trace in patterns.items():
+        print("{:12}".format(name) +
+              "".join("{:8.1%}".format(row_hit_rate(m, trace)) for m in ("RBC", "BRC", "XOR")))
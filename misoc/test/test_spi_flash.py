@@ -0,0 +1,129 @@
+import unittest
+import random
+
+from migen import *
+from migen.fhdl.specials import Tristate
+
+from misoc.cores.spi_flash import SpiFlash
+
+
+class _MockPads:
+    def __init__(self, spi_width):
+        self.clk = Signal()
+        self.cs_n = Signal()
+        self.dq = Signal(spi_width)
+
+
+class _MockTristateImpl(Module):
+    def __init__(self, t):
+        oe = Signal()
+        self.comb += [
+            t.target.eq(t.o),
+            oe.eq(t.oe),
+        ]
+
+
+class _MockTristate:
+    @staticmethod
+    def lower(t):
+        return _MockTristateImpl(t)
+
+
+@passive
+def _flash(pads, dq, dummy, memory, transfers):
+    """SPI flash in mode 0: decodes the command and address of a transfer
+    from the rising edges of the clock, then streams the memory from that
+    address for as long as CS stays low. Appends (command, address) to
+    ``transfers``."""
+    spi_width = len(pads.dq)
+    adr_clocks = 24//spi_width
+    data_clocks = 8 + adr_clocks + dummy
+    clocks = None
+    clk = 0
+    while True:
+        prev_clk, clk = clk, (yield pads.clk)
+        if (yield pads.cs_n):
+            clocks = None
+        elif clk and not prev_clk:
+            if clocks is None:
+                clocks, command, address = 0, 0, 0
+            if clocks < 8:
+                # the command is on dq0
+                command = (command << 1) | ((yield dq.o) & 1)
+            elif clocks < 8 + adr_clocks:
+                address = (address << spi_width) | (yield dq.o)
+                if clocks == 8 + adr_clocks - 1:
+                    transfers.append((command, address))
+            elif clocks >= data_clocks - 1:
+                assert not (yield dq.oe)
+            clocks += 1
+            if clocks >= data_clocks:
+                # bits for the next rising edge, MSB first
+                bit = (clocks - data_clocks)*spi_width
+                byte = memory[(address + bit//8) % len(memory)]
+                yield dq.i.eq((byte >> (8 - spi_width - bit % 8)) & (2**spi_width - 1))
+        yield
+
+
+class TestSpiFlash(unittest.TestCase):
+    def _test_reads(self, spi_width, continuous_read, addresses, restart=()):
+        """Reads the words at ``addresses``, returns the transfers the flash
+        saw. Bitbang mode is used before each of the reads whose index is in
+        ``restart``."""
+        prng = random.Random(spi_width)
+        memory = [prng.randrange(256) for i in range(1024)]
+        pads = _MockPads(spi_width)
+        dut = SpiFlash(pads, continuous_read=continuous_read)
+        transfers = []
+
+        def master():
+            for n, adr in enumerate(addresses):
+                if n in restart:
+                    yield dut.bitbang.storage.eq(0b0100)
+                    yield dut.bitbang_en.storage.eq(1)
+                    for i in range(8):
+                        yield
+                    yield dut.bitbang_en.storage.eq(0)
+                    yield
+                expected = int.from_bytes(bytes(memory[4*adr:4*adr + 4]), "big")
+                self.assertEqual((yield from dut.bus.read(adr)), expected,
+                                 "address {:#x}".format(adr))
+
+        run_simulation(dut, [master(), _flash(pads, dut.dq, 15, memory, transfers)],
+                       special_overrides={Tristate: _MockTristate})
+        opcodes = {4: 0xeb, 2: 0xbb}
+        for command, address in transfers:
+            self.assertEqual(command, opcodes[spi_width])
+        return [address//4 for command, address in transfers]
+
+    def test_sequential(self):
+        for spi_width in 2, 4:
+            for continuous_read in False, True:
+                transfers = self._test_reads(spi_width, continuous_read, range(8))
+                if continuous_read:
+                    self.assertEqual(transfers, [0])
+                else:
+                    self.assertEqual(transfers, list(range(8)))
+
+    def test_non_sequential(self):
+        addresses = [5, 9, 2, 3, 3, 100, 101, 4]
+        for spi_width in 2, 4:
+            for continuous_read in False, True:
+                transfers = self._test_reads(spi_width, continuous_read, addresses)
+                if continuous_read:
+                    self.assertEqual(transfers, [5, 9, 2, 3, 100, 4])
+                else:
+                    self.assertEqual(transfers, addresses)
+
+    def test_restarted(self):
+        # bitbang mode ends a continuous read, the next read starts a
+        # new command even if it is sequential
+        addresses = [0, 1, 2, 3, 4, 5]
+        for spi_width in 2, 4:
+            for continuous_read in False, True:
+                transfers = self._test_reads(spi_width, continuous_read, addresses,
+                                             restart=(2, 5))
+                if continuous_read:
+                    self.assertEqual(transfers, [0, 2, 5])
+                else:
+                    self.assertEqual(transfers, addresses)
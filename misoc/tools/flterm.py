@@ -8,6 +8,8 @@ import asyncserial
 import serial
 import argparse
 
+from misoc.tools.mkmscimg import lz4_compress_prefix, elf_segments
+
 
 if sys.platform == "win32":
     import msvcrt
@@ -55,6 +57,9 @@ sfl_magic_ack = b"z6IHG7cYDID6o\n"
 sfl_cmd_abort = b"\x00"
 sfl_cmd_load  = b"\x01"
 sfl_cmd_jump  = b"\x02"
+sfl_cmd_baudrate = b"\x06"
+sfl_cmd_load_lz4 = b"\x07"
+sfl_cmd_zero     = b"\x08"
 
 # Replies
 sfl_ack_success  = b"K"
@@ -124,7 +129,10 @@ class SFLFrame:
 
 class Flterm:
     def __init__(self, port, speed, kernel_image, kernel_address,
-                 upload_only, output_only):
+                 upload_only, output_only, upload_speed=None, compress=False):
+        self.speed = speed
+        self.compress = compress
+        self.upload_speed = upload_speed
         self.kernel_image = kernel_image
         self.kernel_address = kernel_address
         self.upload_only = upload_only
@@ -160,10 +168,50 @@ class Flterm:
                 print("[FLTERM] Got unknown reply '{}' from the device, aborting.".format(reply))
                 raise ValueError
 
+    @staticmethod
+    def compressed_frame(address, data):
+        # Compress the longest prefix of data whose LZ4 block fits into a
+        # frame next to the address and unpacked length fields.
+        block, length = lz4_compress_prefix(data[:0xffff], 255 - 6)
+        # send incompressible data as a plain load frame
+        if length <= 251:
+            return None, 0
+        frame = SFLFrame()
+        frame.cmd = sfl_cmd_load_lz4
+        frame.payload = address.to_bytes(4, "big")
+        frame.payload += length.to_bytes(2, "big")
+        frame.payload += block
+        return frame, length
+
     async def upload(self, filename, address):
+        """Uploads a binary image to address, or the loadable segments of
+        an ELF file to their load addresses. Returns the boot address."""
         with open(filename, "rb") as f:
             data = f.read()
-        print("[FLTERM] Uploading {} ({} bytes)...".format(filename, len(data)))
+        if data[:4] != b"\x7fELF":
+            print("[FLTERM] Uploading {} ({} bytes)...".format(filename, len(data)))
+            if not await self.upload_data(data, address):
+                return None
+            return address
+
+        entry, endian, segments = elf_segments(data)
+        for seg_address, seg_data, seg_memsize in segments:
+            print("[FLTERM] Uploading segment at 0x{:08x} ({} bytes, {} zero-filled)..."
+                  .format(seg_address, len(seg_data), seg_memsize - len(seg_data)))
+            if seg_data and not await self.upload_data(seg_data, seg_address):
+                return None
+            if seg_memsize > len(seg_data):
+                frame = SFLFrame()
+                frame.cmd = sfl_cmd_zero
+                frame.payload = (seg_address + len(seg_data)).to_bytes(4, "big")
+                frame.payload += (seg_memsize - len(seg_data)).to_bytes(4, "big")
+                try:
+                    await self.send_frame(frame)
+                except ValueError:
+                    return None
+        return entry
+
+    async def upload_data(self, data, address):
         current_address = address
         position = 0
         length = len(data)
@@ -173,42 +221,86 @@ class Flterm:
                                                     ' ' * (20-20*position//length),
                                                     100*position//length))
             sys.stdout.flush()
-            frame = SFLFrame()
-            frame_data = data[:251]
-            frame.cmd = sfl_cmd_load
-            frame.payload = current_address.to_bytes(4, "big")
-            frame.payload += frame_data
+            if self.compress:
+                frame, frame_length = self.compressed_frame(current_address, data)
+            else:
+                frame, frame_length = None, 0
+            if frame is None:
+                frame = SFLFrame()
+                frame_length = min(len(data), 251)
+                frame.cmd = sfl_cmd_load
+                frame.payload = current_address.to_bytes(4, "big")
+                frame.payload += data[:frame_length]
             try:
                 await self.send_frame(frame)
             except ValueError:
-                return
-            current_address += len(frame_data)
-            position += len(frame_data)
-            try:
-                data = data[251:]
-            except:
-                data = []
+                return False
+            current_address += frame_length
+            position += frame_length
+            data = data[frame_length:]
         end = time.time()
         elapsed = end - start
         print("[FLTERM] Upload complete ({0:.1f}KB/s).".format(length/(elapsed*1024)))
-        return length
+        return True
 
-    async def boot(self):
+    async def boot(self, address):
         print("[FLTERM] Booting the device.")
         frame = SFLFrame()
         frame.cmd = sfl_cmd_jump
-        frame.payload = self.kernel_address.to_bytes(4, "big")
+        frame.payload = address.to_bytes(4, "big")
         await self.send_frame(frame)
 
+    def set_speed(self, speed):
+        self.port.ser.baudrate = speed
+
+    async def negotiate_speed(self, speed):
+        frame = SFLFrame()
+        frame.cmd = sfl_cmd_baudrate
+        frame.payload = speed.to_bytes(4, "big")
+        await self.port.write_exactly(frame.encode())
+        reply = await self.port.read(1)
+        if reply != sfl_ack_success:
+            print("[FLTERM] Device refused {} baud (reply '{}'), "
+                  "staying at {} baud.".format(speed, reply, self.speed))
+            return False
+
+        # The device switches once the ack has left its UART, then expects
+        # the same frame again at the new rate. If that exchange fails,
+        # both sides go back to the previous rate.
+        await asyncio.sleep(0.05)
+        self.set_speed(speed)
+        await self.port.write_exactly(frame.encode())
+        try:
+            reply = await asyncio.wait_for(self.port.read(1), 0.5)
+        except asyncio.TimeoutError:
+            reply = None
+        if reply == sfl_ack_success:
+            print("[FLTERM] Switched to {} baud.".format(speed))
+            return True
+
+        print("[FLTERM] No answer at {} baud, falling back to {} baud."
+              .format(speed, self.speed))
+        # outlast the confirmation timeout of the device
+        await asyncio.sleep(1.0)
+        self.set_speed(self.speed)
+        return False
+
     async def answer_magic(self):
         print("[FLTERM] Received firmware download request from the device.")
         await self.port.write_exactly(sfl_magic_ack)
         try:
-            await self.upload(self.kernel_image, self.kernel_address)
+            if self.upload_speed is not None and self.upload_speed != self.speed:
+                await self.negotiate_speed(self.upload_speed)
+            boot_address = await self.upload(self.kernel_image, self.kernel_address)
         except FileNotFoundError:
             print("[FLTERM] File not found")
         else:
-            await self.boot()
+            if boot_address is not None:
+                await self.boot(boot_address)
+        finally:
+            # the device returns to its build-time rate when leaving
+            # the serial boot loop
+            self.set_speed(self.speed)
         print("[FLTERM] Done.");
 
     async def main_coro(self):
@@ -279,10 +371,15 @@ class Flterm:
 def _get_args():
     parser = argparse.ArgumentParser()
     parser.add_argument("port", help="serial port")
-    parser.add_argument("--speed", default=115200, help="serial baudrate")
-    parser.add_argument("--kernel", default=None, help="kernel image")
+    parser.add_argument("--speed", default=115200, type=int, help="serial baudrate")
+    parser.add_argument("--upload-speed", default=None, type=int,
+                        help="serial baudrate to negotiate for the upload")
+    parser.add_argument("--compress", default=False, action="store_true",
+                        help="LZ4-compress the kernel image frames")
+    parser.add_argument("--kernel", default=None,
+                        help="kernel image (binary, or ELF to upload its segments only)")
     parser.add_argument("--kernel-addr", type=lambda a: int(a, 0),
-                        default=0x40000000, help="kernel address")
+                        default=0x40000000, help="kernel address (ignored for ELF images)")
     parser.add_argument("--upload-only", default=False, action="store_true",
                         help="only upload kernel")
     parser.add_argument("--output-only", default=False, action="store_true",
@@ -298,7 +395,8 @@ def main():
         loop = asyncio.get_event_loop()
     args = _get_args()
     flterm = Flterm(args.port, args.speed, args.kernel, args.kernel_addr,
-                    args.upload_only, args.output_only)
+                    args.upload_only, args.output_only, args.upload_speed,
+                    args.compress)
     try:
         flterm.init()
         loop.run_until_complete(flterm.main_task)
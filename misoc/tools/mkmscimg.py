@@ -2,9 +2,142 @@
 
 import argparse
 import binascii
+import struct
 
 
-def insert_crc(i_filename, fbi_mode=False, o_filename=None, little_endian=False):
+# Set in the length word of flash boot images whose payload is LZ4-compressed
+FBI_FLAG_LZ4 = 0x80000000
+# Set in the length word of flash boot images whose payload is a segment table
+FBI_FLAG_SEGMENTED = 0x40000000
+
+
+def lz4_compress(data):
+    """Compresses ``data`` into a single LZ4 block (no frame header)."""
+    block, length = lz4_compress_prefix(data)
+    return block
+
+
+def lz4_compress_prefix(data, max_size=None):
+    """Compresses the longest prefix of ``data`` whose LZ4 block is at most
+    ``max_size`` bytes, in a single pass. Returns the block and the length
+    of the prefix. Without ``max_size``, all of ``data`` is compressed."""
+    min_match = 4
+    # the format requires the last 5 bytes to be literals and the last
+    # match to start at least 12 bytes before the end of the block
+    match_limit = len(data) - 12
+    hash_table = dict()
+    out = bytearray()
+
+    def length_size(n):
+        return 0 if n < 15 else (n - 15)//255 + 1
+
+    def write_length(n):
+        while n >= 255:
+            out.append(255)
+            n -= 255
+        out.append(n)
+
+    def write_sequence(literals, match_length, offset):
+        lit_len = len(literals)
+        token_lit = min(lit_len, 15)
+        token_match = min(match_length - min_match, 15) if offset else 0
+        out.append((token_lit << 4) | token_match)
+        if lit_len >= 15:
+            write_length(lit_len - 15)
+        out.extend(literals)
+        if offset:
+            out.extend(offset.to_bytes(2, "little"))
+            if match_length - min_match >= 15:
+                write_length(match_length - min_match - 15)
+
+    # Best place to end the block with a literal sequence, as (end of the
+    # prefix, output length and anchor at that point). Blocks are cut
+    # after the last sequence that still allows a valid ending to fit.
+    best = None
+
+    def consider(anchor, earliest):
+        nonlocal best
+        room = max_size - len(out) - 1
+        n = min(len(data) - anchor, room)
+        while n > 0 and n + length_size(n) > room:
+            n -= 1
+        if n >= 0 and anchor + n >= earliest and (best is None or anchor + n > best[0]):
+            best = (anchor + n, len(out), anchor)
+
+    anchor = 0
+    if max_size is not None:
+        consider(0, 0)
+    i = 0
+    while i < match_limit:
+        if max_size is not None and len(out) + 1 + (i - anchor) > max_size:
+            # the pending literals alone no longer fit
+            break
+        key = data[i:i+min_match]
+        candidate = hash_table.get(key)
+        hash_table[key] = i
+        if candidate is None or i - candidate > 0xffff:
+            i += 1
+            continue
+        length = min_match
+        end = len(data) - 5
+        while i + length < end and data[candidate + length] == data[i + length]:
+            length += 1
+        write_sequence(data[anchor:i], length, i - candidate)
+        if max_size is not None and len(out) >= max_size:
+            break
+        i += length
+        anchor = i
+        if max_size is not None:
+            consider(anchor, max(anchor + 5, i - length + 12))
+    if max_size is None:
+        write_sequence(data[anchor:], 0, 0)
+        return bytes(out), len(data)
+    length, out_length, anchor = best
+    del out[out_length:]
+    write_sequence(data[anchor:length], 0, 0)
+    return bytes(out), length
+
+
+def elf_segments(data):
+    """Returns the entry point, the endianness and the loadable segments
+    (load address, file data, memory size) of a 32-bit ELF executable."""
+    if data[:4] != b"\x7fELF":
+        raise ValueError("Not an ELF file")
+    if data[4] != 1:
+        raise ValueError("Only 32-bit ELF files are supported")
+    endian = "little" if data[5] == 1 else "big"
+    fmt = "<" if endian == "little" else ">"
+
+    entry, phoff = struct.unpack_from(fmt + "II", data, 24)
+    phentsize, phnum = struct.unpack_from(fmt + "HH", data, 42)
+    segments = []
+    for n in range(phnum):
+        p_type, p_offset, p_vaddr, p_paddr, p_filesz, p_memsz = \
+            struct.unpack_from(fmt + "IIIIII", data, phoff + n*phentsize)
+        if p_type != 1 or not p_memsz:  # PT_LOAD
+            continue
+        # trailing zeros are cleared by the loader along with .bss
+        fdata = data[p_offset:p_offset+p_filesz].rstrip(b"\x00")
+        segments.append((p_paddr, fdata, p_memsz))
+    return entry, endian, segments
+
+
+def segmented_payload(entry, segments, endian):
+    """Lays out a segment table followed by the segment data, each segment
+    padded to a word boundary."""
+    def word(n):
+        return n.to_bytes(4, byteorder=endian)
+
+    payload = word(len(segments)) + word(entry)
+    for address, fdata, memsize in segments:
+        payload += word(address) + word(len(fdata)) + word(memsize)
+    for address, fdata, memsize in segments:
+        payload += fdata + bytes(-len(fdata) % 4)
+    return payload
+
+
+def insert_crc(i_filename, fbi_mode=False, o_filename=None, little_endian=False,
+               compress=False, segmented=False):
     endian = "little" if little_endian else "big"
 
     if o_filename is None:
@@ -12,8 +145,20 @@ def insert_crc(i_filename, fbi_mode=False, o_filename=None, little_endian=False)
 
     with open(i_filename, "rb") as f:
         fdata = f.read()
+    flags = 0
+    if segmented:
+        if not fbi_mode or compress:
+            raise ValueError("Segmented images must be uncompressed flash boot images")
+        entry, endian, segments = elf_segments(fdata)
+        fdata = segmented_payload(entry, segments, endian)
+        flags |= FBI_FLAG_SEGMENTED
+    if compress:
+        if not fbi_mode:
+            raise ValueError("Compression is only supported for flash boot images")
+        fdata = len(fdata).to_bytes(4, byteorder=endian) + lz4_compress(fdata)
+        flags |= FBI_FLAG_LZ4
     fcrc = binascii.crc32(fdata).to_bytes(4, byteorder=endian)
-    flength = len(fdata).to_bytes(4, byteorder=endian)
+    flength = (len(fdata) | flags).to_bytes(4, byteorder=endian)
 
     with open(o_filename, "wb") as f:
         if fbi_mode:
@@ -31,8 +176,11 @@ def main():
     parser.add_argument("-o", "--output", default=None, help="output file (if not specified, use input file)")
     parser.add_argument("-f", "--fbi", default=False, action="store_true", help="build flash boot image (FBI) file")
     parser.add_argument("-l", "--little", default=False, action="store_true", help="Use little endian to write the CRC32")
+    parser.add_argument("-c", "--compress", default=False, action="store_true", help="LZ4-compress the flash boot image payload")
+    parser.add_argument("-s", "--segmented", default=False, action="store_true", help="build a segmented flash boot image from an ELF input file (endianness is taken from the ELF file)")
     args = parser.parse_args()
-    insert_crc(args.input, args.fbi, args.output, args.little)
+    insert_crc(args.input, args.fbi, args.output, args.little, args.compress,
+               args.segmented)
 
 
 if __name__ == "__main__":